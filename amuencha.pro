@@ -16,14 +16,43 @@ INCLUDEPATH += $$PWD/libraries
 
 SOURCES += sources/amuencha.cpp \
     sources/model/frequency_analyzer.cpp \
+    sources/model/song_loader.cpp \
+    sources/model/song_buffer.cpp \
+    sources/model/mapped_file.cpp \
+    sources/model/pcm_file.cpp \
+    sources/model/song_analysis.cpp \
+    sources/model/recording_store.cpp \
+    sources/model/offline_audio.cpp \
+    sources/model/audio_stats.cpp \
+    sources/model/latency_calibrator.cpp \
+    sources/model/video_writer.cpp \
+    sources/visual/spiralrenderer.cpp \
     sources/visual/spiraldisplay.cpp \
+    sources/visual/spiralvideo.cpp \
+    sources/visual/waterfalldisplay.cpp \
     sources/visual/clickableslider.cpp \
     sources/interface/mainwindow.cpp \
     libraries/ring_buffer.cpp
 
 HEADERS  += sources/model/frequency_analyzer.h \
+    sources/model/song_loader.h \
+    sources/model/song_buffer.h \
+    sources/model/mapped_file.h \
+    sources/model/pcm_file.h \
+    sources/model/song_analysis.h \
+    sources/model/bounded_queue.h \
+    sources/model/recording_store.h \
+    sources/model/audio_gate.h \
+    sources/model/audio_kernels.h \
+    sources/model/offline_audio.h \
+    sources/model/audio_stats.h \
+    sources/model/latency_calibrator.h \
+    sources/model/video_writer.h \
     sources/model/sse_mathfun.h \
+    sources/visual/spiralrenderer.h \
     sources/visual/spiraldisplay.h \
+    sources/visual/spiralvideo.h \
+    sources/visual/waterfalldisplay.h \
     sources/visual/clickableslider.h \
     sources/interface/mainwindow.h \
     libraries/ring_buffer.h
@@ -36,7 +65,7 @@ QMAKE_CFLAGS_RELEASE = -O3
 QMAKE_CXXFLAGS += -ffast-math
 
 unix: CONFIG += link_pkgconfig
-unix: PKGCONFIG += libavdevice libavformat libavcodec libavutil libswresample rtaudio
+unix: PKGCONFIG += libavdevice libavformat libavcodec libavutil libswresample libswscale rtaudio
 
 amuencha.path = /usr/bin
 amuencha.files = amuencha
@@ -58,5 +87,5 @@ INSTALLS += amuencha iconsvg iconpng desktop man
 
 # TODO 1: make mxe use Qt5 by default
 # TODO 2: translate these flags for the mxe cross-compilation
-#make CXXFLAGS='-pipe -fno-keep-inline-dllexport -ffast-math -O2 -frtti -fexceptions -mthreads -Wall -Wextra -DUNICODE -DQT_DLL -DQT_NO_DEBUG -DQT_MULTIMEDIA_LIB -DQT_GUI_LIB -DQT_CORE_LIB -DQT_THREAD_SUPPORT -I/usr/local/mxe/include -I/usr/local/mxe/include/QtAV -std=c++11' LIBS='-L/usr/lib/mxe/usr/x86_64-w64-mingw32.shared/qt/lib -lmingw32 -lqtmain -lQtMultimedia4 -lQtGui4 -lQtCore4 -L/usr/local/mxe/lib -lavdevice -lavformat -lavcodec -lavutil -lswresample -lrtaudio -lole32 -lwinmm -lksuser -luuid'
+#make CXXFLAGS='-pipe -fno-keep-inline-dllexport -ffast-math -O2 -frtti -fexceptions -mthreads -Wall -Wextra -DUNICODE -DQT_DLL -DQT_NO_DEBUG -DQT_MULTIMEDIA_LIB -DQT_GUI_LIB -DQT_CORE_LIB -DQT_THREAD_SUPPORT -I/usr/local/mxe/include -I/usr/local/mxe/include/QtAV -std=c++11' LIBS='-L/usr/lib/mxe/usr/x86_64-w64-mingw32.shared/qt/lib -lmingw32 -lqtmain -lQtMultimedia4 -lQtGui4 -lQtCore4 -L/usr/local/mxe/lib -lavdevice -lavformat -lavcodec -lavutil -lswresample -lswscale -lrtaudio -lole32 -lwinmm -lksuser -luuid'
 
@@ -20,13 +20,100 @@
 */
 
 #include "interface/mainwindow.h"
+#include "visual/spiralvideo.h"
 #include <QApplication>
+#include <QCommandLineParser>
+#include <QStandardPaths>
+#include <QDir>
+#include <iostream>
 
 int main(int argc, char *argv[])
 {
     QApplication a(argc, argv);
+    QCoreApplication::setApplicationName("amuencha");
+    
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QCoreApplication::translate("main",
+        "Music analyzer and singing trainer.\n"
+        "Offline mode runs without a sound card, add -platform offscreen for a headless machine."));
+    parser.addHelpOption();
+    QCommandLineOption offline_option("offline", QCoreApplication::translate("main",
+        "Drive the audio from <source> instead of the sound card, as fast as possible, then quit. "
+        "The source is a WAV/AIFF file, silence, noise, sine:<Hz> or chord:<Hz>."), "source");
+    QCommandLineOption output_option("offline-output", QCoreApplication::translate("main",
+        "Write the offline audio output to <file>, as a stereo WAV."), "file");
+    QCommandLineOption rate_option("offline-rate", QCoreApplication::translate("main",
+        "Sample rate of the offline generators."), "Hz", "48000");
+    QCommandLineOption buffer_option("offline-buffer", QCoreApplication::translate("main",
+        "Frames per offline audio buffer."), "frames", "256");
+    QCommandLineOption duration_option("offline-duration", QCoreApplication::translate("main",
+        "Offline run duration, by default the whole input file or song."), "seconds");
+    QCommandLineOption take_option("offline-take", QCoreApplication::translate("main",
+        "Also save the offline recording as a take in the music directory."));
+    QCommandLineOption song_option("song", QCoreApplication::translate("main",
+        "Song to play during the offline run, or to render."), "file");
+    QCommandLineOption fps_option("max-fps", QCoreApplication::translate("main",
+        "Cap the spiral display frame rate, by default the screen refresh rate."), "fps");
+    QCommandLineOption render_option("render", QCoreApplication::translate("main",
+        "Render the spiral of the --song into <file> without any window, then quit. "
+        "The file is a video, or a sequence of images when it ends with .png, "
+        "numbered where a %d or %05d is given. A headless machine needs -platform offscreen."), "file");
+    QCommandLineOption render_size_option("render-size", QCoreApplication::translate("main",
+        "Size of the rendered frames."), "WxH", "1280x720");
+    QCommandLineOption render_fps_option("render-fps", QCoreApplication::translate("main",
+        "Frame rate of the rendering."), "fps", "30");
+    QCommandLineOption render_threads_option("render-threads", QCoreApplication::translate("main",
+        "Threads rendering the frames, by default the number of cores."), "threads", "0");
+    QCommandLineOption no_cache_option("no-cache", QCoreApplication::translate("main",
+        "Do not cache the decoded songs on disk."));
+    parser.addOptions({offline_option, output_option, rate_option, buffer_option, duration_option, song_option, fps_option,
+                       render_option, render_size_option, render_fps_option, render_threads_option, no_cache_option, take_option});
+    parser.process(a);
+    
+    // One cache per user, whatever the directory the application is started from
+    std::string cache_directory;
+    if (!parser.isSet(no_cache_option)) {
+        QString location = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+        if (!location.isEmpty() && QDir().mkpath(location)) cache_directory = location.toStdString();
+    }
+    
+    if (parser.isSet(render_option)) {
+        SpiralVideo::Options options;
+        options.song = parser.value(song_option).toStdString();
+        options.output = parser.value(render_option).toStdString();
+        options.cache_directory = cache_directory;
+        if (options.song.empty()) {
+            std::cerr << "Error: --render needs a --song" << std::endl;
+            return 1;
+        }
+        QStringList size = parser.value(render_size_option).split('x');
+        if (size.size()==2) {
+            options.width = size[0].toInt();
+            options.height = size[1].toInt();
+        }
+        options.fps = parser.value(render_fps_option).toInt();
+        options.num_threads = parser.value(render_threads_option).toInt();
+        options.sample_rate = parser.value(rate_option).toInt();
+        SpiralVideo video(options);
+        return video.run();
+    }
+    
     MainWindow w;
+    w.set_cache_directory(cache_directory);
+    if (parser.isSet(fps_option)) w.set_display_max_fps(parser.value(fps_option).toFloat());
     w.show();
+    
+    if (parser.isSet(offline_option)) {
+        MainWindow::Offline_Options options;
+        options.input = parser.value(offline_option).toStdString();
+        options.output = parser.value(output_option).toStdString();
+        options.song = parser.value(song_option).toStdString();
+        options.sample_rate = parser.value(rate_option).toInt();
+        options.buffer_frames = parser.value(buffer_option).toUInt();
+        if (parser.isSet(duration_option)) options.duration = parser.value(duration_option).toDouble();
+        options.save_take = parser.isSet(take_option);
+        if (!w.start_offline(options)) return 1;
+    }
 
     return a.exec();
 }
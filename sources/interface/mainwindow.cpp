@@ -25,6 +25,9 @@
 #include <list>
 #include <functional>
 #include <algorithm>
+#include <chrono>
+#include <tuple>
+#include <memory>
 
 #include <boost/math/constants/constants.hpp>
 
@@ -39,6 +42,15 @@
 #include <QFileDialog>
 #include <QMessageBox>
 #include <QProgressDialog>
+#include <QCoreApplication>
+#include <QThread>
+#include <QDir>
+#include <QDateTime>
+#include <QStandardPaths>
+#include <QSettings>
+#include <QTimer>
+#include <QEventLoop>
+#include <QWindow>
 
 #include <string.h>
 extern "C" {
@@ -47,6 +59,9 @@ extern "C" {
 #include <libswresample/swresample.h>
 }
 
+#include "model/song_loader.h"
+#include "model/audio_kernels.h"
+
 #include "mainwindow.h"
 #include "ui_mainwindow.h"
 
@@ -182,12 +197,21 @@ MainWindow::MainWindow(QWidget *parent) :
     update_devices(rt_audio->getCurrentApi());
     
     // Defaults are set in the GUI editor
+    ui->spiral_display->set_bins_per_semitone(ui->bins_per_semitone_sb->value());
     ui->spiral_display->set_min_max_notes(ui->min_freq_slider->value(), ui->max_freq_slider->value());
     ui->min_freq_label->setText(ui->spiral_display->get_note_name_and_frequency(ui->min_freq_slider->value()));
     ui->max_freq_label->setText(ui->spiral_display->get_note_name_and_frequency(ui->max_freq_slider->value()));
+    ui->waterfall_display->set_frequencies(ui->spiral_display->get_frequencies());
     ui->spiral_display->set_visual_fading(ui->visual_fading_sb->value());
     on_mic_dup_cb_toggled(ui->mic_dup_cb->isChecked());
+    on_waterfall_cb_toggled(ui->waterfall_cb->isChecked());
     on_display_gain_valueChanged(ui->display_gain->value());
+    ui->buffer_size_cb->addItem(tr("Auto"), 0);
+    for (int frames: {64, 128, 256, 512, 1024, 2048}) ui->buffer_size_cb->addItem(tr("%1 frames").arg(frames), frames);
+    
+    // The audio thread only publishes the positions, the sliders are updated at display rate
+    connect(&position_timer, SIGNAL(timeout()), this, SLOT(update_positions()));
+    position_timer.start(position_update_ms);
     
     
     main_window = this;
@@ -196,6 +220,9 @@ MainWindow::MainWindow(QWidget *parent) :
 MainWindow::~MainWindow()
 {
     if (rt_audio->isStreamOpen()) rt_audio->abortStream();
+    if (offline_driver) offline_driver->stop();
+    if (offline_thread.joinable()) offline_thread.join();
+    delete offline_driver;
     
     delete record_analyzer;
     delete song_analyzer;
@@ -249,6 +276,7 @@ int audio_available_callback(void *outputBuffer, void *inputBuffer, unsigned int
            double streamTime, RtAudioStreamStatus status, void *user_data)
 {
     MainWindow* mw = (MainWindow*)user_data;
+    const auto callback_start = chrono::steady_clock::now();
 
 /*    
     // Replace by fake sinusoids to test the algo
@@ -270,82 +298,152 @@ int audio_available_callback(void *outputBuffer, void *inputBuffer, unsigned int
     // => no input muxing here TODO: handle stereo input,
     // like in the former acquire_samples<double> (see git history)
     
-    mw->audio_mutex.lock();
-    if (mw->is_recording && !mw->replay_mode) {
-        // general mic gain before all other operations
-        for (int i=0; i<nBufferFrames; ++i) ((float*)inputBuffer)[i] *= mw->mic_gain;
-        
-        // store data for replay
-        mw->recording.emplace_back(make_pair(mw->song_position, vector<float>(nBufferFrames)));
-        float* samples = &mw->recording.back().second[0];
-        copy((float*)inputBuffer, (float*)inputBuffer+nBufferFrames, samples);
+    // The latency calibration replaces everything else while it runs
+    Latency_Calibrator* calibrator = mw->calibrator;
+    if (calibrator) {
+        calibrator->process((const float*)inputBuffer, nBufferFrames, &mw->line_scratch[0]);
+        if (outputBuffer) audio_kernels::mix_to_stereo(&mw->line_scratch[0], nBufferFrames, 1.f, 0, 0, 0.f, (float*)outputBuffer, nBufferFrames);
+        return 0;
+    }
+    
+    // No lock here: the transport state is read from atomics, and the GUI
+    // closes the gates while it swaps the song or clears the recording
+    const bool replay_mode = mw->replay_mode;
+    const bool record_open = mw->record_gate.enter();
+    const bool song_open = mw->song_gate.enter();
+    
+    const float* input = (const float*)inputBuffer;
+    // the line to output, if any, and its length
+    const float* line = (input && mw->mic_dup) ? input : 0;
+    int line_size = nBufferFrames;
+    
+    if (record_open && input && mw->is_recording && !replay_mode) {
+        // store data for replay, without allocating here
+        // the general mic gain is applied on the fly, before all other operations
+        const float mic_gain = mw->mic_gain;
+        // the input was sung over the song heard one round trip earlier
+        int64_t heard_position = max((int64_t)0, mw->song_position.load() - mw->recording_latency);
+        int64_t position = mw->recording.append(mw->is_playing ? heard_position : -1, input, nBufferFrames, mic_gain);
         
-        // feed data to the analyzer associated with this line
-        if (mw->record_analyzer) mw->record_analyzer->new_data(samples, nBufferFrames);
-    }
-    
-    // process the input
-    if (!mw->mic_dup) std::fill((float*)inputBuffer,(float*)inputBuffer+nBufferFrames,0.f);
-    
-    if (mw->replay_mode && mw->replay_position<mw->replay_view.size()) {
-        float* samples = &mw->replay_view[mw->replay_position].get().second[0];
-        int sample_size = mw->replay_view[mw->replay_position].get().second.size();
-        if (mw->record_analyzer) mw->record_analyzer->new_data(samples, sample_size);
-        copy(samples, samples + min((int)nBufferFrames,sample_size), (float*)inputBuffer);
-        // in practice, sample_size and nBufferFrames are always equal
-        // for Jack, but for other systems...
-        for (int i=sample_size; i<nBufferFrames; ++i) ((float*)inputBuffer)[i] = 0;
-    }
-    
-    if ((mw->is_playing && !mw->replay_mode) 
-    || (mw->replay_mode && mw->replay_position<mw->replay_view.size())) {
-        int song_position = mw->replay_mode ? mw->replay_view[mw->replay_position].get().first : mw->song_position;
-        int nframes = mw->replay_mode ? min((int)mw->replay_view[mw->replay_position].get().second.size(),(int)nBufferFrames) : nBufferFrames;
-        float* song = &mw->song[song_position];
-        float* samples = (float*)inputBuffer;
-        if (song_position+nframes > mw->song.size()) {
-            int nplayed = mw->song.size() - song_position;
-            for (int i=0; i<nplayed; ++i) {
-                samples[i] = samples[i] * mw->rec_mix_factor + song[i] * mw->song_mix_factor;
-            }
-            for (int i=nplayed; i<=nframes; ++i) {
-                samples[i] = samples[i] * mw->rec_mix_factor;
-            }
-            if (mw->song_analyzer) mw->song_analyzer->new_data(&mw->song[song_position], nplayed);
-            if (!mw->replay_mode) mw->set_song_position(mw->song_position + nplayed, false);
+        const float* samples = 0;
+        if (position>=0 && mw->recording.span(position, nBufferFrames, samples)==nBufferFrames) {
+            // feed data to the analyzer associated with this line
+            if (mw->record_analyzer) mw->record_analyzer->new_data(samples, nBufferFrames);
+            if (line) line = samples;
         }
         else {
-            for (int i=0; i<nframes; ++i) {
-                samples[i] = samples[i] * mw->rec_mix_factor + song[i] * mw->song_mix_factor;
-            }
-            if (mw->song_analyzer) mw->song_analyzer->new_data(&mw->song[song_position], nframes);
-            if (!mw->replay_mode) mw->set_song_position(mw->song_position + nframes, false);
+            // dropped, or across two blocks: the input buffer is ours anyway
+            if (line) audio_kernels::apply_gain(input, mic_gain, (float*)inputBuffer, nBufferFrames);
+            if (mw->record_analyzer && position>=0) mw->feed_recording(mw->record_analyzer, position, nBufferFrames);
         }
-        if (mw->replay_mode) mw->set_replay_position(mw->replay_position+1, false);
     }
-    mw->audio_mutex.unlock();
     
-    // stereo output with non-interleaved channels is just dup
-    //std::copy((float*)inputBuffer, (float*)inputBuffer+nBufferFrames, (float*)outputBuffer);
-    //std::copy((float*)inputBuffer, (float*)inputBuffer+nBufferFrames, (float*)outputBuffer+nBufferFrames);
-    for (int i=0; i<nBufferFrames; ++i) {
-        *((float*)outputBuffer + i*2 ) = *((float*)inputBuffer + i);
-        *((float*)outputBuffer + i*2 + 1) = *((float*)inputBuffer + i);
+    // replay_position is a sample position in the take
+    int64_t replay_position = mw->replay_position;
+    const bool replaying = record_open && replay_mode && replay_position<mw->recording.size();
+    if (replaying) {
+        line_size = (int)min((int64_t)nBufferFrames, mw->recording.size() - replay_position);
+        if (mw->record_analyzer) mw->feed_recording(mw->record_analyzer, replay_position, line_size);
+        if (mw->recording.span(replay_position, line_size, line)<line_size) {
+            // rare, once per block
+            line_size = min(line_size, (int)mw->line_scratch.size());
+            mw->recording.read(replay_position, line_size, &mw->line_scratch[0]);
+            line = &mw->line_scratch[0];
+        }
+    }
+    
+    const float* song = 0;
+    int nplayed = 0;
+    float rec_mix_factor = 1, song_mix_factor = 1;
+    const int64_t replay_song_position = replaying ? mw->recording.song_position_at(replay_position) : -1;
+    if (song_open && ((mw->is_playing && !replay_mode) || replay_song_position>=0)) {
+        int64_t song_position = replaying ? replay_song_position : mw->song_position.load();
+        int nframes = replaying ? line_size : nBufferFrames;
+        nplayed = (int)max((int64_t)0, min((int64_t)nframes, mw->song.size() - song_position));
+        song = mw->read_song(song_position, nplayed);
+        rec_mix_factor = mw->rec_mix_factor;
+        song_mix_factor = mw->song_mix_factor;
+        if (mw->song_analyzer && nplayed>0) mw->song_analyzer->new_data(song, nplayed);
+        // a seek from the GUI in the meantime takes precedence
+        // the sliders follow from the GUI thread, see update_positions
+        if (!replay_mode) mw->song_position.compare_exchange_strong(song_position, song_position + nplayed);
     }
+    if (replaying) mw->replay_position.compare_exchange_strong(replay_position, replay_position+line_size);
+    
+    // single pass for the mix and the stereo output with interleaved channels
+    if (outputBuffer) audio_kernels::mix_to_stereo(line, line_size, rec_mix_factor, song, nplayed, song_mix_factor, (float*)outputBuffer, nBufferFrames);
+    
+    if (song_open) mw->song_gate.leave();
+    if (record_open) mw->record_gate.leave();
+    
+    // the driver reports the overflows and underflows since the previous buffer
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - callback_start).count();
+    mw->audio_stats.add_callback(status & RTAUDIO_INPUT_OVERFLOW, status & RTAUDIO_OUTPUT_UNDERFLOW,
+                                 elapsed * mw->sampling_rate / nBufferFrames);
 
     return 0;
 }
 
+// Stands in for audio_available_callback while the buffer size is tuned:
+// the same kernels run on scratch buffers and the output is silent, so the
+// song, the recording and the analyzers are left alone. Only the timing
+// matters
+int buffer_probe_callback(void *outputBuffer, void *inputBuffer, unsigned int nBufferFrames,
+           double streamTime, RtAudioStreamStatus status, void *user_data)
+{
+    MainWindow* mw = (MainWindow*)user_data;
+    const auto callback_start = chrono::steady_clock::now();
+    
+    const int count = min((int)nBufferFrames, (int)mw->probe_scratch.size());
+    float* scratch = &mw->probe_scratch[0];
+    if (inputBuffer) audio_kernels::apply_gain((const float*)inputBuffer, mw->mic_gain, scratch, count);
+    else memset(scratch, 0, count * sizeof(float));
+    if (outputBuffer) audio_kernels::mix_to_stereo(scratch, count, 0.f, scratch, count, 0.f, (float*)outputBuffer, nBufferFrames);
+    
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - callback_start).count();
+    mw->audio_stats.add_callback(status & RTAUDIO_INPUT_OVERFLOW, status & RTAUDIO_OUTPUT_UNDERFLOW,
+                                 elapsed * mw->sampling_rate / nBufferFrames);
+    return 0;
+}
+
+void MainWindow::feed_recording(Frequency_Analyzer* analyzer, int64_t position, int count)
+{
+    // the stored samples stay in place, they are given by pointer span by span
+    while (count>0) {
+        const float* samples;
+        int n = recording.span(position, count, samples);
+        if (n<=0) return;
+        analyzer->new_data(samples, n);
+        position += n;
+        count -= n;
+    }
+}
+
+const float* MainWindow::read_song(int64_t position, int count)
+{
+    if (song.get_format()==Song_Buffer::FLOAT32) return song.data() + position;
+    // Compact songs are converted into a ring of scratch buffers. The song analyzer
+    // keeps pointers to the chunks until its next cycle, the ring is long enough
+    // for these to remain valid until then
+    count = min(count, (int)song_scratch.size());
+    if (song_scratch_pos + count > (int)song_scratch.size()) song_scratch_pos = 0;
+    float* scratch = &song_scratch[song_scratch_pos];
+    song_scratch_pos += count;
+    return song.read(position, count, scratch);
+}
+
 void audio_error_callback(RtAudioError::Type type, const std::string &errorText) {
     // TODO: inter-thread communication, using main_window widget here from another thread is NOK
     //QMessageBox::warning(main_window,QString("Audio stream error"),QString::fromStdString(errorText));
     
+    if (main_window) main_window->audio_stats.add_error();
     std::cout << errorText << std::endl;
 }
 
 float MainWindow::get_sample_rate()
 {
     if (sampling_rate) return sampling_rate;
+    if (offline_driver) return offline_driver->get_sample_rate();
     
     // The sample rate parameter is problematic as it must match the device sample rate
     // And when in/out do not match, with no duplex mode, then problem.
@@ -368,6 +466,17 @@ void MainWindow::setup_lines_in_out()
     // internal logic: lines already open <=> sampling rate set
     assert(sampling_rate == 0);
     
+    if (offline_driver) {
+        // no sound card, the offline driver calls the callback itself
+        sampling_rate = offline_driver->get_sample_rate();
+        song_scratch.assign((int)sampling_rate, 0.f);
+        song_scratch_pos = 0;
+        line_scratch.assign(max(offline_buffer_frames, (unsigned int)(sampling_rate * 0.1)), 0.f);
+        ui->latency_label->setText(tr("Offline, %1 frames").arg(offline_buffer_frames));
+        audio_stats.reset();
+        return;
+    }
+    
     // Attempt to open the lines in/out
     int ndevices = rt_audio->getDeviceCount();
     
@@ -402,8 +511,15 @@ void MainWindow::setup_lines_in_out()
     try {
         sampling_rate = get_sample_rate();
         
+        // one second of conversion space for compact songs
+        song_scratch.assign((int)sampling_rate, 0.f);
+        song_scratch_pos = 0;
+        
         //unsigned int nframes = 0; // query the smallest amount of frames that can be returned, for minimal latency
-        unsigned int nframes = (int)(sampling_rate * 0.001); // each 1ms
+        unsigned int nframes = ui->buffer_size_cb->itemData(ui->buffer_size_cb->currentIndex()).toUInt();
+        // auto: the smallest size that runs without dropouts on these devices
+        if (nframes==0) nframes = tune_buffer_size(op, ip, options);
+        audio_stats.reset();
 
         rt_audio->openStream(op, ip, 
             // Ask for conversion to float for the frequency analyzer using SSE.
@@ -417,7 +533,18 @@ void MainWindow::setup_lines_in_out()
             audio_error_callback
         );
         
+        // replayed samples that cross a block boundary are gathered there
+        line_scratch.assign(max(nframes, (unsigned int)(sampling_rate * 0.1)), 0.f);
+        
         rt_audio->startStream();
+        
+        // the driver may have adjusted the requested size
+        long stream_latency = rt_audio->getStreamLatency();
+        // the measured round trip, if the lines were calibrated
+        recording_latency = load_latency(latency_key());
+        ui->latency_label->setText(tr("%1 frames, %2 ms").arg(nframes).arg(nframes * 1000. / sampling_rate, 0, 'f', 1)
+            + (stream_latency>0 ? tr(" (%1 ms in+out)").arg(stream_latency * 1000. / sampling_rate, 0, 'f', 1) : QString())
+            + (recording_latency>0 ? tr(", round trip %1 ms").arg(recording_latency * 1000. / sampling_rate, 0, 'f', 1) : QString()));
     }
     catch ( RtAudioError& e ) {
         ui->chords_sequence->insertPlainText(QString::fromStdString(e.getMessage()));
@@ -428,132 +555,333 @@ void MainWindow::setup_lines_in_out()
     ui->liste_micros->setEnabled(false);
     ui->liste_sorties->setEnabled(false);
     ui->periods_sb->setEnabled(false);
+    ui->bins_per_semitone_sb->setEnabled(false);
+    ui->buffer_size_cb->setEnabled(false);
     ui->min_freq_slider->setEnabled(false);
     ui->max_freq_slider->setEnabled(false);
 }
 
+unsigned int MainWindow::tune_buffer_size(RtAudio::StreamParameters* op, RtAudio::StreamParameters* ip, RtAudio::StreamOptions& options)
+{
+    // probed once per device pair and rate
+    std::tuple<int,int,int> key((ip ? (int)ip->deviceId : -1), (op ? (int)op->deviceId : -1), (int)sampling_rate);
+    auto tuned = tuned_buffer_sizes.find(key);
+    if (tuned!=tuned_buffer_sizes.end()) return tuned->second;
+    
+    QProgressDialog progress(tr("Tuning the audio buffer size..."), QString(), 0, ui->buffer_size_cb->count()-1, this);
+    progress.setWindowModality(Qt::WindowModal);
+    unsigned int chosen = 0;
+    // the driver may round the sizes up, leave some room
+    probe_scratch.assign(2 * ui->buffer_size_cb->itemData(ui->buffer_size_cb->count()-1).toUInt(), 0.f);
+    // smallest sizes first, skipping the "Auto" entry
+    for (int i=1; i<ui->buffer_size_cb->count() && !chosen; ++i) {
+        progress.setValue(i-1);
+        QCoreApplication::processEvents();
+        unsigned int nframes = ui->buffer_size_cb->itemData(i).toUInt();
+        audio_stats.reset();
+        try {
+            rt_audio->openStream(op, ip, RTAUDIO_FLOAT32, sampling_rate, &nframes,
+                                 &buffer_probe_callback, this, &options, audio_error_callback);
+            rt_audio->startStream();
+            // the GUI keeps repainting meanwhile, the modal dialog holds the user input
+            QEventLoop wait;
+            QTimer::singleShot(buffer_probe_ms, &wait, SLOT(quit()));
+            wait.exec(QEventLoop::ExcludeUserInputEvents);
+            rt_audio->stopStream();
+            rt_audio->closeStream();
+        }
+        catch ( RtAudioError& ) {
+            if (rt_audio->isStreamOpen()) rt_audio->closeStream();
+            continue;
+        }
+        // the first buffers often underflow while the devices start, only
+        // a stable stream with some headroom in the callback is accepted
+        int expected_callbacks = (int)(buffer_probe_ms * 0.001 * sampling_rate / nframes);
+        if (audio_stats.get_num_xruns()<=1 && audio_stats.get_num_callbacks()>=expected_callbacks/2
+            && audio_stats.get_max_load() < buffer_probe_load) chosen = nframes;
+    }
+    progress.setValue(ui->buffer_size_cb->count()-1);
+    vector<float>().swap(probe_scratch);
+    // nothing stable, fall back on the largest size
+    if (!chosen) chosen = ui->buffer_size_cb->itemData(ui->buffer_size_cb->count()-1).toUInt();
+    tuned_buffer_sizes[key] = chosen;
+    return chosen;
+}
+
+void MainWindow::showEvent(QShowEvent *event)
+{
+    QMainWindow::showEvent(event);
+    // the native window only exists once shown, it tells when it is obscured
+    if (windowHandle()) windowHandle()->installEventFilter(this);
+    update_analysis_suspension();
+}
+
+void MainWindow::hideEvent(QHideEvent *event)
+{
+    QMainWindow::hideEvent(event);
+    update_analysis_suspension();
+}
+
+void MainWindow::changeEvent(QEvent *event)
+{
+    QMainWindow::changeEvent(event);
+    if (event->type()==QEvent::WindowStateChange) update_analysis_suspension();
+}
+
+bool MainWindow::eventFilter(QObject *watched, QEvent *event)
+{
+    if (watched==windowHandle() && event->type()==QEvent::Expose) update_analysis_suspension();
+    return QMainWindow::eventFilter(watched, event);
+}
+
+void MainWindow::update_analysis_suspension()
+{
+    // offline runs measure the whole processing, whatever the window
+    bool visible = offline_driver || (isVisible() && !isMinimized() && (!windowHandle() || windowHandle()->isExposed()));
+    if (analysis_suspended == !visible) return;
+    analysis_suspended = !visible;
+    // The audio lines, recording and playback go on. The analyzers only keep
+    // buffering the signal, so nothing reaches the displays, and the spiral
+    // render thread, which only runs on request, sleeps as well
+    if (song_analyzer) song_analyzer->set_suspended(analysis_suspended);
+    if (record_analyzer) record_analyzer->set_suspended(analysis_suspended);
+}
+
+void MainWindow::set_display_max_fps(float fps)
+{
+    ui->spiral_display->set_max_fps(fps);
+}
+
+bool MainWindow::start_offline(const Offline_Options& options)
+{
+    offline_driver = new Offline_Audio_Driver();
+    if (!offline_driver->open_input(options.input, options.sample_rate)) {
+        cerr << "Error: cannot open the offline input " << options.input << endl;
+        return false;
+    }
+    if (!options.output.empty() && !offline_driver->open_output(options.output)) {
+        cerr << "Error: cannot write the offline output " << options.output << endl;
+        return false;
+    }
+    offline_buffer_frames = options.buffer_frames;
+    offline_save_take = options.save_take;
+    // even with an offscreen or never exposed window
+    update_analysis_suspension();
+    
+    // same path as the GUI: the song plays, and the input is recorded and analyzed
+    if (!options.song.empty()) load_song(options.song);
+    if (offline_failed) return false;
+    ui->bouton_enregistrer->click();
+    if (offline_failed || !sampling_rate) return false;
+    
+    int64_t duration = (int64_t)(options.duration * sampling_rate);
+    if (options.duration<0) {
+        if (offline_driver->get_input_frames()>=0) duration = -1;
+        else if (!song.empty()) duration = song.size();
+        else duration = (int64_t)(10 * sampling_rate);
+    }
+    
+    offline_thread = std::thread([this, duration]() {
+        // the recording blocks are written and reserved in step, so that
+        // running faster than real time never drops samples
+        offline_stats = offline_driver->run(&audio_available_callback, this, offline_buffer_frames, duration,
+                                            [this]() {recording.maintain_now();});
+        QMetaObject::invokeMethod(this, "offline_finished", Qt::QueuedConnection);
+    });
+    return true;
+}
+
+void MainWindow::offline_finished()
+{
+    // already joined when the lines were stopped from the GUI
+    if (offline_thread.joinable()) offline_thread.join();
+    // the lines may have been stopped meanwhile, resetting sampling_rate
+    double audio_seconds = offline_stats.num_frames / (double)offline_driver->get_sample_rate();
+    cout << "Offline run: " << audio_seconds << " s of audio in " << offline_stats.callback_seconds
+         << " s of callback time (" << audio_seconds / max(1e-9, offline_stats.callback_seconds) << "x real time), "
+         << offline_stats.num_callbacks << " buffers of " << offline_buffer_frames << " frames, longest "
+         << offline_stats.max_callback_ms << " ms, " << recording.get_num_dropped() << " samples dropped" << endl;
+    cout << audio_stats.report();
+    QCoreApplication::quit();
+}
+
+void MainWindow::report_error(const QString& title, const QString& message, bool critical)
+{
+    if (offline_driver) {
+        cerr << "Error: " << message.toStdString() << endl;
+        offline_failed = true;
+        return;
+    }
+    if (critical) QMessageBox::critical(this, title, message);
+    else QMessageBox::warning(this, title, message);
+}
+
+// The latencies are user settings, kept with the others whatever the working directory
+// The keys hold device names, escaped so that QSettings takes them as plain keys
+int MainWindow::load_latency(const std::string& key)
+{
+    QSettings settings("amuencha", "amuencha");
+    return settings.value(QString("latencies/") + QString::fromLatin1(QUrl::toPercentEncoding(QString::fromStdString(key))), 0).toInt();
+}
+
+void MainWindow::save_latency(const std::string& key, int latency)
+{
+    QSettings settings("amuencha", "amuencha");
+    settings.setValue(QString("latencies/") + QString::fromLatin1(QUrl::toPercentEncoding(QString::fromStdString(key))), latency);
+    settings.sync();
+    if (settings.status()!=QSettings::NoError) cerr << "Error: cannot save the latency in " << settings.fileName().toStdString() << endl;
+}
+
+std::string MainWindow::latency_key()
+{
+    return QString("%1|%2|%3|%4").arg((int)sampling_rate).arg(ui->liste_drivers->currentText())
+        .arg(ui->liste_micros->currentText()).arg(ui->liste_sorties->currentText()).toStdString();
+}
+
+void MainWindow::on_calibrate_button_clicked()
+{
+    if (sampling_rate) {
+        QMessageBox::information(this,tr("Latency calibration"),tr("Stop the song, the recording and the replay first."));
+        return;
+    }
+    if (QMessageBox::question(this,tr("Latency calibration"),
+        tr("A short sweep will be played. Put the microphone close to the speakers, or connect the output to the input."),
+        QMessageBox::Ok | QMessageBox::Cancel) != QMessageBox::Ok) return;
+    
+    setup_lines_in_out();
+    if (!sampling_rate) return; // error while setting the lines
+    float rate = sampling_rate;
+    std::string key = latency_key();
+    
+    Latency_Calibrator measure((int)rate);
+    calibrator = &measure;
+    QProgressDialog progress(tr("Measuring the latency..."), tr("Abort"), 0, 100, this);
+    progress.setWindowModality(Qt::WindowModal);
+    while (!measure.is_finished() && !progress.wasCanceled()) {
+        progress.setValue((int)(measure.get_progress() * 100));
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 20);
+        QThread::msleep(20);
+    }
+    // the stream is stopped before the calibrator goes away
+    stop_lines_in_out();
+    calibrator = 0;
+    progress.setValue(100);
+    if (!measure.is_finished()) return;
+    
+    int latency = measure.estimate();
+    if (latency<0) {
+        QMessageBox::warning(this,tr("Latency calibration"),tr("The test signal was not heard back, check the volume and the devices."));
+        return;
+    }
+    recording_latency = latency;
+    save_latency(key, latency);
+    ui->chords_sequence->appendPlainText(tr("Round-trip latency: %1 ms (%2 frames)").arg(latency * 1000. / rate, 0, 'f', 1).arg(latency));
+}
+
 void MainWindow::stop_lines_in_out()
 {
-    rt_audio->stopStream();
+    if (!offline_driver) {
+        rt_audio->stopStream();
+        // closed too, so the next opening may use another buffer size
+        rt_audio->closeStream();
+    }
+    else {
+        // the offline run calls into the analyzers and the recording
+        offline_driver->stop();
+        if (offline_thread.joinable()) offline_thread.join();
+    }
+    ui->buffer_size_cb->setEnabled(true);
     ui->liste_drivers->setEnabled(true);
     ui->liste_micros->setEnabled(true);
     ui->liste_sorties->setEnabled(true);
     ui->periods_sb->setEnabled(true);
+    ui->bins_per_semitone_sb->setEnabled(true);
     ui->min_freq_slider->setEnabled(true);
     ui->max_freq_slider->setEnabled(true);
     sampling_rate = 0;
-    audio_mutex.lock();
+    // the stream is stopped, the callback cannot use the analyzers anymore
     delete record_analyzer; record_analyzer = 0;
     delete song_analyzer; song_analyzer = 0;
-    audio_mutex.unlock();
 }
 
 void MainWindow::on_bouton_ouvrir_clicked()
 {
-    AVFormatContext *fmt_ctx = 0;
-    AVCodec *dec = 0;
-    AVCodecContext *dec_ctx = 0;
-    
     string fileName = QFileDialog::getOpenFileName(this, tr("Open File")).toStdString();
     if (fileName.empty()) return;
-    if (avformat_open_input(&fmt_ctx, fileName.c_str(), 0, 0)<0) {
-        QMessageBox::critical(this,tr("Can't open file"),tr("File is unreadable."));
-        return;
-    }
-    if (avformat_find_stream_info(fmt_ctx, NULL) < 0) {
-        QMessageBox::critical(this,tr("Can't open file"),tr("File info cannot be parsed."));
-        return;
-    }
-    int audio_stream_index = av_find_best_stream(fmt_ctx, AVMEDIA_TYPE_AUDIO, -1, -1, &dec, 0);
-    if (audio_stream_index < 0) {
-        QMessageBox::critical(this,tr("Can't open file"),tr("Cannot find an audio stream."));
-        return;
-    }
-    dec_ctx = avcodec_alloc_context3(dec);
-    if (!dec_ctx) {
-        QMessageBox::critical(this,tr("Can't open file"),tr("Not enough memory to create the codec."));
-        return;
-    }
-    avcodec_parameters_to_context(dec_ctx, fmt_ctx->streams[audio_stream_index]->codecpar);
-    av_opt_set_int(dec_ctx, "refcounted_frames", 1, 0);
-    if (avcodec_open2(dec_ctx, dec, NULL) < 0) {
-        QMessageBox::critical(this,tr("Can't open file"),tr("Format is not recognized."));
-        return;
-    }
-    
-    AVPacket packet;
-    AVFrame *frame = av_frame_alloc();
-    if (!frame) {
-        QMessageBox::critical(this,tr("Can't decode file"),tr("Not enough memory to create the frames."));
-        return;
-    }
-    
-    SwrContext *swr = swr_alloc();
-    av_opt_set_int(swr, "in_channel_layout",  dec_ctx->channel_layout, 0);
-    av_opt_set_int(swr, "out_channel_layout", AV_CH_LAYOUT_MONO ,  0);
-    av_opt_set_int(swr, "in_sample_rate",     dec_ctx->sample_rate, 0);
-    av_opt_set_int(swr, "out_sample_rate",    (int)get_sample_rate(), 0);
-    av_opt_set_sample_fmt(swr, "in_sample_fmt",  dec_ctx->sample_fmt, 0);
-    av_opt_set_sample_fmt(swr, "out_sample_fmt", AV_SAMPLE_FMT_FLTP,  0);
-    swr_init(swr);
-    
-    int estimated_num_samples = (int)((int64_t)get_sample_rate() * fmt_ctx->duration / AV_TIME_BASE);
-    song.clear();
-    // reserve with little extra half-second for the approximation
-    song.reserve(estimated_num_samples+(int64_t)(get_sample_rate()*0.5));
-    
-    QProgressDialog progress(tr("Loading song..."), tr("Abort"), 0, estimated_num_samples, this);
-    progress.setWindowModality(Qt::WindowModal);
+    load_song(fileName);
+}
 
-    while (true) {
-        if (av_read_frame(fmt_ctx, &packet)<0) break;
-        if (packet.stream_index!=audio_stream_index) {
-            av_packet_unref(&packet);
-            continue;
-        }
-        
-        if (avcodec_send_packet(dec_ctx, &packet)<0) {
-            QMessageBox::critical(this,tr("Can't decode file"),tr("Error while sending a packet to the decoder."));
-            break;
+void MainWindow::load_song(const std::string& fileName)
+{
+    // Decoding and analysis happen on other threads, in parallel segments for long files
+    Song_Loader loader;
+    loader.set_cache_directory(cache_directory);
+    Song_Loader::Status status = loader.start(fileName, (int)get_sample_rate(),
+        ui->compact_song_cb->isChecked() ? Song_Buffer::BLOCK_FLOAT16 : Song_Buffer::FLOAT32);
+    
+    if (status==Song_Loader::OK) {
+        int estimated_num_samples = (int)loader.get_estimated_num_samples();
+        // no dialog in offline runs, nobody could abort it
+        std::unique_ptr<QProgressDialog> progress;
+        if (!offline_driver) {
+            progress.reset(new QProgressDialog(tr("Loading song..."), tr("Abort"), 0, estimated_num_samples, this));
+            progress->setWindowModality(Qt::WindowModal);
         }
-        int ret = 1;
-        while (ret >= 0) {
-            ret = avcodec_receive_frame(dec_ctx, frame);
-            if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) break;
-            if (ret < 0) {
-                QMessageBox::critical(this,tr("Can't decode file"),tr("Error while receiving a frame from the decoder."));
-                goto end;
+        while (!loader.is_finished()) {
+            if (progress) {
+                progress->setValue(min((int)loader.get_num_processed_samples(), estimated_num_samples));
+                if (progress->wasCanceled()) loader.abort();
             }
-            
-            int cur_size = song.size();
-            song.resize(cur_size+frame->nb_samples);
-            uint8_t* outbuf = reinterpret_cast<uint8_t*>(&song[cur_size]);
-            swr_convert(swr, &outbuf, frame->nb_samples, const_cast<const uint8_t**>(frame->extended_data), frame->nb_samples);
-            
-            progress.setValue(song.size());
-            
-            av_frame_unref(frame);
+            QCoreApplication::processEvents(QEventLoop::AllEvents, 20);
+            QThread::msleep(20);
         }
-        av_packet_unref(&packet);
+        Song_Buffer new_song;
+        status = loader.finish(new_song, song_analysis);
+        if (!new_song.empty()) {
+            // the audio thread may be playing the previous song, and the
+            // analyzer may still point to its samples: both are done with
+            // them once the gate is closed, so they can be freed after
+            song_gate.close();
+            if (song_analyzer) song_analyzer->invalidate_samples();
+            song.swap(new_song);
+            song_position = 0;
+            song_gate.open();
+        }
+        if (progress) progress->setValue(estimated_num_samples);
     }
-end:
-    // flush the last few samples, second by second of output
-    int cur_size = song.size();
-    int max_to_read = song.capacity() - song.size();
-    song.resize(song.capacity());
-    uint8_t* outbuf = reinterpret_cast<uint8_t*>(&song[cur_size]);
-    int num_read = swr_convert(swr, &outbuf, max_to_read, 0, 0);
-    song.resize(cur_size+num_read);
-    
-    progress.setValue(song.size());
-    avcodec_free_context(&dec_ctx);
-    avformat_close_input(&fmt_ctx);
-    av_frame_free(&frame);
-    swr_free(&swr);
     
-    progress.setValue(estimated_num_samples);
+    switch (status) {
+        case Song_Loader::OK: break;
+        case Song_Loader::ABORTED: return;
+        case Song_Loader::CANNOT_OPEN:
+            report_error(tr("Can't open file"), tr("File is unreadable."));
+            return;
+        case Song_Loader::NO_STREAM_INFO:
+            report_error(tr("Can't open file"), tr("File info cannot be parsed."));
+            return;
+        case Song_Loader::NO_AUDIO_STREAM:
+            report_error(tr("Can't open file"), tr("Cannot find an audio stream."));
+            return;
+        case Song_Loader::NO_MEMORY:
+            report_error(tr("Can't open file"), tr("Not enough memory to create the codec."));
+            return;
+        case Song_Loader::UNKNOWN_FORMAT:
+            report_error(tr("Can't open file"), tr("Format is not recognized."));
+            return;
+        case Song_Loader::DECODE_ERROR:
+            // keep whatever could be decoded before the error, if any
+            report_error(tr("Can't decode file"), tr("Error while decoding the file."));
+            break;
+    }
     
     //ui->chords_sequence->appendPlainText("Read "+QString::number(song.size()));
+    if (song_analysis.tempo>0) ui->chords_sequence->appendPlainText(
+        tr("Tempo: %1 BPM, %2 beats").arg(song_analysis.tempo, 0, 'f', 1).arg(song_analysis.beats.size()));
+    int key = song_analysis.estimate_key();
+    if (key>=0) {
+        static const char* key_names[12] = {"C", "C#", "D", "Eb", "E", "F", "F#", "G", "Ab", "A", "Bb", "B"};
+        ui->chords_sequence->appendPlainText(key<12 ? tr("Key: %1 major").arg(key_names[key]) : tr("Key: %1 minor").arg(key_names[key-12]));
+    }
     if (song.size()>0) {
         ui->play_pause->setEnabled(true);
         ui->positionChanson->setEnabled(true);
@@ -563,14 +891,12 @@ end:
     ui->play_pause->click();
 }
 
-void MainWindow::common_clicked(bool& is_doing, QPushButton* button, 
+void MainWindow::common_clicked(std::atomic<bool>& is_doing, QPushButton* button, 
                     const char* theme_start, const char* theme_stop, 
-                    Frequency_Analyzer* &analyzer, int id) 
+                    Frequency_Analyzer* &analyzer, Audio_Gate& gate, int id) 
 {
-    audio_mutex.lock();
     if (is_doing) {
         is_doing = false;
-        audio_mutex.unlock();
         
         if (!is_recording && !is_playing && !replay_mode) stop_lines_in_out();
         
@@ -578,25 +904,24 @@ void MainWindow::common_clicked(bool& is_doing, QPushButton* button,
         
         return;
     }
-    audio_mutex.unlock();
     
     if (!sampling_rate) setup_lines_in_out();
     if (!sampling_rate) return; // error while setting the lines
 
-    audio_mutex.lock();
-    
     if (!analyzer) {
-        analyzer = new Frequency_Analyzer(this);
-        using namespace std::placeholders;
-        analyzer->setup(sampling_rate, 
-                        ui->spiral_display->frequencies, 
-                        std::bind(&SpiralDisplay::power_handler, ui->spiral_display, id, _1, _2), 
+        Frequency_Analyzer* new_analyzer = new Frequency_Analyzer(this);
+        new_analyzer->setup(sampling_rate, 
+                        ui->spiral_display->get_frequencies(), 
+                        display_handler(id), 
                         ui->periods_sb->value());
-        analyzer->start(QThread::NormalPriority);
+        new_analyzer->set_suspended(analysis_suspended);
+        new_analyzer->start(QThread::NormalPriority);
+        gate.close();
+        analyzer = new_analyzer;
+        gate.open();
     }
     
     is_doing = true;
-    audio_mutex.unlock();
     
     button->setIcon(QIcon::fromTheme(theme_stop));
 }
@@ -605,20 +930,36 @@ void MainWindow::on_play_pause_clicked()
 {
     common_clicked(is_playing, ui->play_pause, 
                    "media-playback-start", "media-playback-pause",
-                   song_analyzer, 0);
+                   song_analyzer, song_gate, 0);
 }
 
 void MainWindow::on_bouton_enregistrer_clicked()
 {
     common_clicked(is_recording, ui->bouton_enregistrer, 
                    "media-record", "media-playback-stop",
-                   record_analyzer, 1);
+                   record_analyzer, record_gate, 1);
     // just started new recording => erase old samples
     if (is_recording) {
-        audio_mutex.lock();
+        // the callback skips recording until the new take is ready
+        record_gate.close();
+        // the analyzer may still point to the old samples
+        if (record_analyzer) record_analyzer->invalidate_samples();
         recording.clear();
-        replay_view.clear();
-        audio_mutex.unlock();
+        // each take is streamed to its own file in the user music directory,
+        // so it is kept after the application exits
+        // Offline runs only keep the take in memory, unless asked
+        bool take_ok = true;
+        if (!offline_driver || offline_save_take) {
+            QString directory = QStandardPaths::writableLocation(QStandardPaths::MusicLocation);
+            if (!directory.isEmpty()) directory += "/Amuencha";
+            take_ok = !directory.isEmpty() && QDir().mkpath(directory);
+            if (take_ok) {
+                QString take_name = directory + "/take_" + QDateTime::currentDateTime().toString("yyyyMMdd_hhmmss") + ".wav";
+                take_ok = recording.start_take(take_name.toStdString(), (int)sampling_rate);
+            }
+        }
+        record_gate.open();
+        if (!take_ok) report_error(tr("Can't save the recording"), tr("The take will only be kept in memory."), false);
     }
 
     // whether starting new, or stopping old, replay is allowed now
@@ -630,10 +971,8 @@ void MainWindow::on_bouton_enregistrer_clicked()
 
 void MainWindow::on_bouton_rejouer_clicked()
 {
-    audio_mutex.lock();
     if (replay_mode) {
-        replay_mode = false;
-        audio_mutex.unlock();
+        end_replay();
         if (!is_recording && !is_playing && !replay_mode) stop_lines_in_out();
         ui->bouton_rejouer->setIcon(QIcon::fromTheme("media-playback-start"));
         ui->positionRecord->setEnabled(false);
@@ -643,32 +982,33 @@ void MainWindow::on_bouton_rejouer_clicked()
         return;
     }
     
-    if (recording.empty()) {
-        audio_mutex.unlock();
+    if (recording.empty()) return;
+    
+    // maps the part of the take already streamed to disk
+    if (!recording.prepare_replay()) {
+        QMessageBox::critical(this,tr("Can't replay"),tr("The recording file cannot be read."));
         return;
     }
     
+    // no chunk is appended while replaying, the recording stays as is
+    set_replay_position(0);
     replay_mode = true;
-    replay_view.clear();
-    replay_view.insert(replay_view.end(), recording.begin(), recording.end());
-    set_replay_position(0,false);
-
-    audio_mutex.unlock();
     
     if (!sampling_rate) setup_lines_in_out();
     if (!sampling_rate) return; // error while setting the lines
 
-    audio_mutex.lock();
     if (!record_analyzer) {
-        record_analyzer = new Frequency_Analyzer(this);
-        using namespace std::placeholders;
-        record_analyzer->setup(sampling_rate, 
-                        ui->spiral_display->frequencies, 
-                        std::bind(&SpiralDisplay::power_handler, ui->spiral_display, 1, _1, _2), 
+        Frequency_Analyzer* new_analyzer = new Frequency_Analyzer(this);
+        new_analyzer->setup(sampling_rate, 
+                        ui->spiral_display->get_frequencies(), 
+                        display_handler(1), 
                         ui->periods_sb->value());
-        record_analyzer->start(QThread::NormalPriority);
+        new_analyzer->set_suspended(analysis_suspended);
+        new_analyzer->start(QThread::NormalPriority);
+        record_gate.close();
+        record_analyzer = new_analyzer;
+        record_gate.open();
     }
-    audio_mutex.unlock();
     
     ui->bouton_rejouer->setIcon(QIcon::fromTheme("media-playback-stop"));
     ui->bouton_enregistrer->setEnabled(false);
@@ -677,27 +1017,36 @@ void MainWindow::on_bouton_rejouer_clicked()
     ui->positionRecord->setEnabled(true);
 }
 
+void MainWindow::end_replay()
+{
+    replay_mode = false;
+    // the callback and the record analyzer must be done with the replayed
+    // blocks before the recording may release them again
+    record_gate.close();
+    if (record_analyzer) record_analyzer->invalidate_samples();
+    record_gate.open();
+    recording.end_replay();
+}
+
 void MainWindow::on_clear_record_clicked()
 {
     // stop replay mode
-    audio_mutex.lock();
     if (replay_mode) {
-        replay_mode = false;
-        audio_mutex.unlock();
+        end_replay();
         if (!is_recording && !is_playing && !replay_mode) stop_lines_in_out();
         ui->bouton_rejouer->setIcon(QIcon::fromTheme("media-playback-start"));
         ui->positionRecord->setEnabled(false);
         ui->bouton_enregistrer->setEnabled(true);
         ui->play_pause->setEnabled(!song.empty());
         ui->positionChanson->setEnabled(!song.empty());
-        audio_mutex.lock();
     }
     
+    // the callback skips the recording while it is cleared, the song keeps playing
+    record_gate.close();
     if (record_analyzer) record_analyzer->invalidate_samples();
-    
     recording.clear();
-    replay_view.clear();
-    audio_mutex.unlock();
+    replay_position = 0;
+    record_gate.open();
     
     ui->bouton_rejouer->setEnabled(is_recording);
     ui->positionRecord->setEnabled(false);
@@ -714,6 +1063,7 @@ void MainWindow::on_display_gain_valueChanged(int value)
     // max value*0.01 is 2, hence max gain here is 16
     // but the non-linear progression makes it easier to cover larger gain range depending on mic
     ui->spiral_display->set_gain(pow(value*0.01, 4));
+    ui->waterfall_display->set_gain(pow(value*0.01, 4));
 }
 
 void MainWindow::on_mic_dup_cb_toggled(bool checked)
@@ -725,12 +1075,37 @@ void MainWindow::on_min_freq_slider_valueChanged(int value)
 {
     ui->min_freq_label->setText(ui->spiral_display->get_note_name_and_frequency(value));
     ui->spiral_display->set_min_max_notes(ui->min_freq_slider->value(), ui->max_freq_slider->value());
+    ui->waterfall_display->set_frequencies(ui->spiral_display->get_frequencies());
 }
 
 void MainWindow::on_max_freq_slider_valueChanged(int value)
 {
     ui->max_freq_label->setText(ui->spiral_display->get_note_name_and_frequency(value));
     ui->spiral_display->set_min_max_notes(ui->min_freq_slider->value(), ui->max_freq_slider->value());
+    ui->waterfall_display->set_frequencies(ui->spiral_display->get_frequencies());
+}
+
+void MainWindow::on_bins_per_semitone_sb_valueChanged(int value)
+{
+    // the analyzers only exist while the lines are open, and this is disabled then
+    ui->spiral_display->set_bins_per_semitone(value);
+    ui->waterfall_display->set_frequencies(ui->spiral_display->get_frequencies());
+}
+
+void MainWindow::on_waterfall_cb_toggled(bool checked)
+{
+    ui->waterfall_display->setVisible(checked);
+}
+
+Frequency_Analyzer::PowerHandler MainWindow::display_handler(int id)
+{
+    // both displays get the same spectra
+    SpiralDisplay* spiral = ui->spiral_display;
+    WaterfallDisplay* waterfall = ui->waterfall_display;
+    return [spiral, waterfall, id](const std::vector<float>& reassigned, const std::vector<float>& power) {
+        spiral->power_handler(id, reassigned, power);
+        waterfall->power_handler(id, reassigned, power);
+    };
 }
 
 void MainWindow::on_visual_fading_sb_valueChanged(int value)
@@ -744,34 +1119,54 @@ void MainWindow::on_song_rec_mix_valueChanged(int value)
     rec_mix_factor = (value>=50) ? 1.0f : (value / 50.f);
 }
 
-void MainWindow::set_song_position(int64_t position, bool lock) {
-    if (lock) audio_mutex.lock();
+void MainWindow::set_song_position(int64_t position) {
     song_position = position;
+    show_song_position(position);
+}
+
+void MainWindow::show_song_position(int64_t position) {
     ui->positionChanson->blockSignals(true);
-    ui->positionChanson->setValue((int)(position*100/(int64_t)song.size()));
+    ui->positionChanson->setValue((int)(position*100/max((int64_t)1,song.size())));
     ui->positionChanson->blockSignals(false);
-    if (lock) audio_mutex.unlock();
 }
 
-void MainWindow::set_replay_position(int64_t position, bool lock) {
-    if (lock) audio_mutex.lock();
+void MainWindow::set_replay_position(int64_t position) {
     replay_position = position;
+    show_replay_position(position);
+}
+
+void MainWindow::show_replay_position(int64_t position) {
     ui->positionRecord->blockSignals(true);
-    ui->positionRecord->setValue((int)(position*100/(int64_t)replay_view.size()));
+    ui->positionRecord->setValue((int)(position*replay_slider_steps/max((int64_t)1,recording.size())));
     ui->positionRecord->blockSignals(false);
-    if (lock) audio_mutex.unlock();
+}
+
+void MainWindow::update_positions()
+{
+    // leave the sliders alone while the user drags them
+    if ((is_playing || replay_mode) && !ui->positionChanson->isSliderDown()) {
+        int64_t position = song_position;
+        show_song_position(position);
+        // page in the next seconds of a mapped song before the audio thread needs them
+        if (is_playing && !replay_mode) song.prefetch(position, (int64_t)(sampling_rate * 2));
+    }
+    if (replay_mode && !ui->positionRecord->isSliderDown()) show_replay_position(replay_position);
+    if (sampling_rate) ui->audio_stats_label->setText(QString::fromStdString(audio_stats.summary()));
+}
+
+void MainWindow::on_audio_stats_button_clicked()
+{
+    std::string report = audio_stats.report();
+    ui->chords_sequence->appendPlainText(QString::fromStdString(report));
+    cout << report;
 }
 
 void MainWindow::on_positionChanson_valueChanged(int value)
 {
-    audio_mutex.lock();
-    song_position = (int64_t)value * (int64_t)song.size() / 100;
-    audio_mutex.unlock();
+    song_position = (int64_t)value * song.size() / 100;
 }
 
 void MainWindow::on_positionRecord_valueChanged(int value)
 {
-    audio_mutex.lock();
-    replay_position = (int64_t)value * (int64_t)replay_view.size() / 100;
-    audio_mutex.unlock();
+    replay_position = (int64_t)value * recording.size() / replay_slider_steps;
 }
@@ -22,16 +22,19 @@
 #ifndef MAINWINDOW_H
 #define MAINWINDOW_H
 
-#include <list>
 #include <vector>
 #include <map>
 #include <functional>
+#include <string>
+#include <atomic>
+#include <tuple>
+#include <thread>
 
 #include <QMainWindow>
 #include <QFile>
 #include <QProcess>
-#include <QMutex>
 #include <QPushButton>
+#include <QTimer>
 
 // midi related
 #include <ring_buffer.h>
@@ -39,6 +42,13 @@
 #include <rtaudio/RtAudio.h>
 
 #include "model/frequency_analyzer.h"
+#include "model/song_buffer.h"
+#include "model/song_analysis.h"
+#include "model/recording_store.h"
+#include "model/audio_gate.h"
+#include "model/offline_audio.h"
+#include "model/audio_stats.h"
+#include "model/latency_calibrator.h"
 
 struct MyRtAudio : public RtAudio {
     using RtAudio::RtAudio;
@@ -58,6 +68,28 @@ public:
     explicit MainWindow(QWidget *parent = 0);
     ~MainWindow();
     
+    // Offline mode: the callback is driven from a file or a generator instead
+    // of the sound card, as fast as possible, then the application quits
+    // See Offline_Audio_Driver for the input sources
+    struct Offline_Options {
+        std::string input = "chord:261.63";
+        std::string output;
+        std::string song;
+        int sample_rate = 48000;
+        unsigned int buffer_frames = 256;
+        // in seconds, <0 for the whole input file or song
+        double duration = -1;
+        // also stream the recorded input to a take file, as the GUI does
+        bool save_take = false;
+    };
+    bool start_offline(const Offline_Options& options);
+    
+    // Caps the spiral display frame rate, <=0 for the screen refresh rate
+    void set_display_max_fps(float fps);
+    
+    // Where the decoded songs are cached, empty for no cache
+    void set_cache_directory(const std::string& directory) {cache_directory = directory;}
+    
 protected slots:
 
     void on_bouton_ouvrir_clicked();
@@ -71,49 +103,126 @@ protected slots:
     
     void on_min_freq_slider_valueChanged(int value);
     void on_max_freq_slider_valueChanged(int value);
+    void on_bins_per_semitone_sb_valueChanged(int value);
+    void on_waterfall_cb_toggled(bool checked);
     void on_visual_fading_sb_valueChanged(int value);
     void on_song_rec_mix_valueChanged(int value);
     void on_positionChanson_valueChanged(int value);
     void on_positionRecord_valueChanged(int value);
     void on_gain_valueChanged(int value);
+    void update_positions();
+    void offline_finished();
+    void on_audio_stats_button_clicked();
+    void on_calibrate_button_clicked();
     
 protected:
+    // The analysis is suspended while the window cannot be seen: hidden,
+    // minimized, or entirely covered by other windows
+    void showEvent(QShowEvent *event) override;
+    void hideEvent(QHideEvent *event) override;
+    void changeEvent(QEvent *event) override;
+    bool eventFilter(QObject *watched, QEvent *event) override;
+    void update_analysis_suspension();
+    
     void update_devices(RtAudio::Api api);
+    void load_song(const std::string& fileName);
+    // A dialog in the GUI. Offline runs may have no one to close it: the
+    // message goes to stderr instead, and the run fails
+    void report_error(const QString& title, const QString& message, bool critical = true);
+    // called from the audio thread, returns the song samples as floats
+    const float* read_song(int64_t position, int count);
+    // called from the audio thread, gives the recorded samples to the analyzer
+    void feed_recording(Frequency_Analyzer* analyzer, int64_t position, int count);
     float get_sample_rate();
-    void set_song_position(int64_t position, bool lock = true);
-    void set_replay_position(int64_t position, bool lock = true);
-    void common_clicked(bool& is_doing, QPushButton* button, 
+    void set_song_position(int64_t position);
+    void set_replay_position(int64_t position);
+    void show_song_position(int64_t position);
+    void show_replay_position(int64_t position);
+    void common_clicked(std::atomic<bool>& is_doing, QPushButton* button, 
                         const char* theme_start, const char* theme_stop, 
-                        Frequency_Analyzer* &analyzer, int id); 
+                        Frequency_Analyzer* &analyzer, Audio_Gate& gate, int id); 
     
+    // stops the replay, and lets the recording release its old blocks again
+    void end_replay();
     void setup_lines_in_out();
+    // feeds the spectra of the given source to the spiral and the waterfall
+    Frequency_Analyzer::PowerHandler display_handler(int id);
+    // identifies the driver, devices and rate for the latency calibration
+    std::string latency_key();
+    // latency measured previously for that key, in frames, 0 when unknown
+    int load_latency(const std::string& key);
+    void save_latency(const std::string& key, int latency);
+    unsigned int tune_buffer_size(RtAudio::StreamParameters* op, RtAudio::StreamParameters* ip, RtAudio::StreamOptions& options);
     void stop_lines_in_out();
     
     Ui::MainWindow *ui;
     MyRtAudio* rt_audio = 0;
-    typedef std::list<std::pair<int64_t,std::vector<float>>> AudioRecording;
-    AudioRecording recording;
-    std::vector<std::reference_wrapper<AudioRecording::value_type>> replay_view;
-    int64_t replay_position = 0;
-    std::vector<float> song;
-    int64_t song_position = 0;
-    bool is_recording = false;
-    bool is_playing = false;
-    bool replay_mode = false;
-    bool mic_dup;
-    float song_mix_factor = 1;
-    float rec_mix_factor = 1;
-    float mic_gain = 1;
+    // replay_position is a sample position in the recording
+    Recording_Store recording;
+    // the replay slider steps, fine enough to seek within a fraction of a second in long takes
+    static const int replay_slider_steps = 10000;
+    std::vector<float> line_scratch;
+    std::atomic<int64_t> replay_position {0};
+    Song_Buffer song;
+    std::string cache_directory;
+    // Onsets, tempo and chroma computed while loading the song
+    Song_Analysis song_analysis;
+    std::vector<float> song_scratch;
+    int song_scratch_pos = 0;
+    // Transport state, shared with the audio callback without locking
+    std::atomic<int64_t> song_position {0};
+    std::atomic<bool> is_recording {false};
+    std::atomic<bool> is_playing {false};
+    std::atomic<bool> replay_mode {false};
+    std::atomic<bool> mic_dup {false};
+    std::atomic<float> song_mix_factor {1};
+    std::atomic<float> rec_mix_factor {1};
+    std::atomic<float> mic_gain {1};
     
     Frequency_Analyzer* record_analyzer = 0;
     Frequency_Analyzer* song_analyzer = 0;
+    // the window is not visible, see update_analysis_suspension
+    bool analysis_suspended = false;
     
     // the sample rate as set by the lines in/out, or 0
     // use get_sample_rate() that sets up the lines first
     float sampling_rate = 0;
     
-    QMutex audio_mutex;
+    // Auto buffer size: each candidate runs for a while, and is kept if the
+    // callback never took more than this fraction of the buffer duration
+    static const int buffer_probe_ms = 400;
+    static constexpr double buffer_probe_load = 0.25;
+    // the probe callback works there, see buffer_probe_callback
+    std::vector<float> probe_scratch;
+    // (input device, output device, rate) => frames per buffer
+    std::map<std::tuple<int,int,int>, unsigned int> tuned_buffer_sizes;
+    // Measured by the audio callback, reset for each stream
+    Audio_Stats audio_stats;
+    
+    // Set while measuring the round-trip latency, see on_calibrate_button_clicked
+    std::atomic<Latency_Calibrator*> calibrator {0};
+    // Round-trip latency in frames, the recorded input is aligned on the
+    // song heard that much earlier
+    std::atomic<int64_t> recording_latency {0};
+    
+    Offline_Audio_Driver* offline_driver = 0;
+    unsigned int offline_buffer_frames = 256;
+    bool offline_save_take = false;
+    bool offline_failed = false;
+    std::thread offline_thread;
+    Offline_Audio_Driver::Stats offline_stats;
+    
+    // Closed by the GUI while it changes the song (and its analyzer) or the
+    // recording (and the record analyzer), the callback skips them meanwhile
+    Audio_Gate song_gate;
+    Audio_Gate record_gate;
+    
+    // the sliders follow the positions published by the audio thread
+    static const int position_update_ms = 40;
+    QTimer position_timer;
     friend int audio_available_callback(void*, void *, unsigned int, double, RtAudioStreamStatus, void *);
+    friend int buffer_probe_callback(void*, void *, unsigned int, double, RtAudioStreamStatus, void *);
+    friend void audio_error_callback(RtAudioError::Type type, const std::string &errorText);
 
 private slots:
     void on_clear_record_clicked();
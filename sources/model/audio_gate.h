@@ -0,0 +1,60 @@
+/*
+  Analyseur de MUsique et ENtraînement au CHAnt
+
+  This file is released under either of the two licenses below, your choice:
+  - LGPL v2.1 or later, https://www.gnu.org
+    The GNU Lesser General Public Licence, version 2.1 or,
+    at your option, any later version.
+  - CeCILL-C, http://www.cecill.info
+    The CeCILL-C license is more adapted to the French laws,
+    but can be converted to the GNU LGPL.
+
+  You can use, modify and/or redistribute the software under the terms of any
+  of these licences, which should have been provided to you together with this
+  sofware. If that is not the case, you can find a copy of the licences on
+  the indicated web sites.
+
+  By Nicolas . Brodu @ Inria . fr
+
+  See http://nicolas.brodu.net/programmation/amuencha/ for more information
+*/
+
+#ifndef AUDIO_GATE_H
+#define AUDIO_GATE_H
+
+#include <atomic>
+#include <thread>
+
+// Excludes the audio callback from some shared state while another thread
+// modifies it, without the callback ever waiting: while the gate is closed,
+// the callback skips whatever the gate protects for that buffer.
+// Only the non-RT side waits, at most for the end of the current callback.
+// There must be a single audio thread entering the gate.
+class Audio_Gate
+{
+public:
+    // Audio thread. Returns false when the gate is closed, leave() must
+    // then not be called
+    bool enter() {
+        inside.store(true);
+        if (closed.load()) {
+            inside.store(false, std::memory_order_release);
+            return false;
+        }
+        return true;
+    }
+    void leave() {inside.store(false, std::memory_order_release);}
+
+    // Other threads. Once close() returns, the callback is out and stays out
+    void close() {
+        closed.store(true);
+        while (inside.load()) std::this_thread::yield();
+    }
+    void open() {closed.store(false, std::memory_order_release);}
+
+protected:
+    std::atomic<bool> inside {false};
+    std::atomic<bool> closed {false};
+};
+
+#endif // AUDIO_GATE_H
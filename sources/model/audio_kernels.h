@@ -0,0 +1,85 @@
+/*
+  Analyseur de MUsique et ENtraînement au CHAnt
+
+  This file is released under either of the two licenses below, your choice:
+  - LGPL v2.1 or later, https://www.gnu.org
+    The GNU Lesser General Public Licence, version 2.1 or,
+    at your option, any later version.
+  - CeCILL-C, http://www.cecill.info
+    The CeCILL-C license is more adapted to the French laws,
+    but can be converted to the GNU LGPL.
+
+  You can use, modify and/or redistribute the software under the terms of any
+  of these licences, which should have been provided to you together with this
+  sofware. If that is not the case, you can find a copy of the licences on
+  the indicated web sites.
+
+  By Nicolas . Brodu @ Inria . fr
+
+  See http://nicolas.brodu.net/programmation/amuencha/ for more information
+*/
+
+#ifndef AUDIO_KERNELS_H
+#define AUDIO_KERNELS_H
+
+#include <cstring>
+
+// Vectorized kernels for the audio callback, one pass per buffer.
+// They accept any length and alignment: the bulk is processed 4 samples at
+// a time with unaligned loads and stores, then the remainder one by one.
+namespace audio_kernels {
+
+typedef float v4sf __attribute__ ((vector_size (16)));
+
+inline v4sf load4(const float* p) {v4sf v; memcpy(&v, p, sizeof(v)); return v;}
+inline void store4(float* p, v4sf v) {memcpy(p, &v, sizeof(v));}
+
+// out = in * gain, out may be in
+inline void apply_gain(const float* in, float gain, float* out, int count)
+{
+    const v4sf g = {gain, gain, gain, gain};
+    int i = 0;
+    for (; i+4<=count; i+=4) store4(out+i, load4(in+i) * g);
+    for (; i<count; ++i) out[i] = in[i] * gain;
+}
+
+// Mixes the mono line (rec, may be null for silence) with the song, and
+// duplicates the result on both channels of the interleaved stereo output
+// rec has num_rec valid samples, song has num_song, the rest is silence
+inline void mix_to_stereo(const float* rec, int num_rec, float rec_factor,
+                          const float* song, int num_song, float song_factor,
+                          float* stereo, int count)
+{
+    if (!rec) num_rec = 0;
+    if (!song) num_song = 0;
+    const v4sf rf = {rec_factor, rec_factor, rec_factor, rec_factor};
+    const v4sf sf = {song_factor, song_factor, song_factor, song_factor};
+    // common part with both sources, then only one of them, then silence
+    const int both = num_rec < num_song ? num_rec : num_song;
+    const int any = num_rec > num_song ? num_rec : num_song;
+    int i = 0;
+    for (; i+4<=both; i+=4) {
+        v4sf m = load4(rec+i) * rf + load4(song+i) * sf;
+        v4sf lo = {m[0], m[0], m[1], m[1]};
+        v4sf hi = {m[2], m[2], m[3], m[3]};
+        store4(stereo + i*2, lo);
+        store4(stereo + i*2 + 4, hi);
+    }
+    for (; i<both; ++i) stereo[i*2] = stereo[i*2+1] = rec[i] * rec_factor + song[i] * song_factor;
+    const float* single = num_rec > num_song ? rec : song;
+    const v4sf f = num_rec > num_song ? rf : sf;
+    const float factor = num_rec > num_song ? rec_factor : song_factor;
+    for (; i+4<=any; i+=4) {
+        v4sf m = load4(single+i) * f;
+        v4sf lo = {m[0], m[0], m[1], m[1]};
+        v4sf hi = {m[2], m[2], m[3], m[3]};
+        store4(stereo + i*2, lo);
+        store4(stereo + i*2 + 4, hi);
+    }
+    for (; i<any; ++i) stereo[i*2] = stereo[i*2+1] = single[i] * factor;
+    if (i<count) memset(stereo + i*2, 0, (count-i)*2*sizeof(float));
+}
+
+}
+
+#endif // AUDIO_KERNELS_H
@@ -0,0 +1,84 @@
+/*
+  Analyseur de MUsique et ENtraînement au CHAnt
+
+  This file is released under either of the two licenses below, your choice:
+  - LGPL v2.1 or later, https://www.gnu.org
+    The GNU Lesser General Public Licence, version 2.1 or,
+    at your option, any later version.
+  - CeCILL-C, http://www.cecill.info
+    The CeCILL-C license is more adapted to the French laws,
+    but can be converted to the GNU LGPL.
+
+  You can use, modify and/or redistribute the software under the terms of any
+  of these licences, which should have been provided to you together with this
+  sofware. If that is not the case, you can find a copy of the licences on
+  the indicated web sites.
+
+  By Nicolas . Brodu @ Inria . fr
+
+  See http://nicolas.brodu.net/programmation/amuencha/ for more information
+*/
+
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+
+#include "audio_stats.h"
+
+using namespace std;
+
+void Audio_Stats::reset()
+{
+    num_callbacks = 0;
+    input_overflows = 0;
+    output_underflows = 0;
+    num_errors = 0;
+    max_load_ppm = 0;
+    total_load_ppm = 0;
+    for (int i=0; i<num_bins; ++i) histogram[i] = 0;
+}
+
+void Audio_Stats::add_callback(bool input_overflow, bool output_underflow, double load)
+{
+    // relaxed increments, the readers only need eventually consistent values
+    num_callbacks.fetch_add(1, memory_order_relaxed);
+    if (input_overflow) input_overflows.fetch_add(1, memory_order_relaxed);
+    if (output_underflow) output_underflows.fetch_add(1, memory_order_relaxed);
+    int64_t ppm = (int64_t)(load * 1e6);
+    total_load_ppm.fetch_add(ppm, memory_order_relaxed);
+    int64_t max_ppm = max_load_ppm.load(memory_order_relaxed);
+    while (ppm>max_ppm && !max_load_ppm.compare_exchange_weak(max_ppm, ppm, memory_order_relaxed)) {}
+    int bin = min(num_bins-1, max(0, (int)(load / bin_width)));
+    histogram[bin].fetch_add(1, memory_order_relaxed);
+}
+
+double Audio_Stats::get_mean_load() const
+{
+    int64_t n = num_callbacks;
+    return n ? total_load_ppm * 1e-6 / n : 0;
+}
+
+std::string Audio_Stats::summary() const
+{
+    ostringstream out;
+    out << "xruns: " << input_overflows << " in, " << output_underflows << " out";
+    if (num_errors) out << ", " << num_errors << " errors";
+    out << " - load " << fixed << setprecision(0) << get_mean_load()*100 << "% avg, " << get_max_load()*100 << "% max";
+    return out.str();
+}
+
+std::string Audio_Stats::report() const
+{
+    ostringstream out;
+    out << num_callbacks << " callbacks, " << summary() << "\n";
+    out << "Callback time / buffer period:\n";
+    int64_t n = max((int64_t)1, num_callbacks.load());
+    for (int i=0; i<num_bins; ++i) {
+        if (!histogram[i]) continue;
+        out << setw(4) << (int)(i*bin_width*100+0.5) << "%";
+        if (i<num_bins-1) out << " - " << setw(3) << (int)((i+1)*bin_width*100+0.5) << "%";
+        else out << " and more";
+        out << ": " << histogram[i] << " (" << fixed << setprecision(2) << histogram[i] * 100. / n << "%)\n";
+    }
+    return out.str();
+}
@@ -0,0 +1,76 @@
+/*
+  Analyseur de MUsique et ENtraînement au CHAnt
+
+  This file is released under either of the two licenses below, your choice:
+  - LGPL v2.1 or later, https://www.gnu.org
+    The GNU Lesser General Public Licence, version 2.1 or,
+    at your option, any later version.
+  - CeCILL-C, http://www.cecill.info
+    The CeCILL-C license is more adapted to the French laws,
+    but can be converted to the GNU LGPL.
+
+  You can use, modify and/or redistribute the software under the terms of any
+  of these licences, which should have been provided to you together with this
+  sofware. If that is not the case, you can find a copy of the licences on
+  the indicated web sites.
+
+  By Nicolas . Brodu @ Inria . fr
+
+  See http://nicolas.brodu.net/programmation/amuencha/ for more information
+*/
+
+#ifndef AUDIO_STATS_H
+#define AUDIO_STATS_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Lock-free counters filled by the audio callback, readable at any time from
+// other threads: driver overflows and underflows, stream errors, and a
+// histogram of the callback execution time as a fraction of the buffer
+// period. This tells apart the glitches caused by our load, when the
+// callback runs close to or above the period, from the driver ones.
+class Audio_Stats
+{
+public:
+    // bins of 5% of the buffer period, the last one counts the overruns
+    static const int num_bins = 21;
+    static constexpr double bin_width = 0.05;
+
+    Audio_Stats() {reset();}
+
+    // Not concurrent with the audio thread, between two streams
+    void reset();
+
+    // Audio thread, once per buffer. load = execution time / buffer period
+    void add_callback(bool input_overflow, bool output_underflow, double load);
+    // Any thread, for the errors reported by the driver
+    void add_error() {++num_errors;}
+
+    int64_t get_num_callbacks() const {return num_callbacks;}
+    int64_t get_input_overflows() const {return input_overflows;}
+    int64_t get_output_underflows() const {return output_underflows;}
+    int64_t get_num_xruns() const {return input_overflows + output_underflows;}
+    int64_t get_num_errors() const {return num_errors;}
+    // fraction of the buffer period
+    double get_max_load() const {return max_load_ppm * 1e-6;}
+    double get_mean_load() const;
+    int64_t get_bin(int i) const {return histogram[i];}
+
+    // one line summary, and a full report with the histogram
+    std::string summary() const;
+    std::string report() const;
+
+protected:
+    std::atomic<int64_t> num_callbacks;
+    std::atomic<int64_t> input_overflows;
+    std::atomic<int64_t> output_underflows;
+    std::atomic<int64_t> num_errors;
+    // in parts per million, to keep integer atomics
+    std::atomic<int64_t> max_load_ppm;
+    std::atomic<int64_t> total_load_ppm;
+    std::atomic<int64_t> histogram[num_bins];
+};
+
+#endif // AUDIO_STATS_H
@@ -0,0 +1,81 @@
+/*
+  Analyseur de MUsique et ENtraînement au CHAnt
+
+  This file is released under either of the two licenses below, your choice:
+  - LGPL v2.1 or later, https://www.gnu.org
+    The GNU Lesser General Public Licence, version 2.1 or,
+    at your option, any later version.
+  - CeCILL-C, http://www.cecill.info
+    The CeCILL-C license is more adapted to the French laws,
+    but can be converted to the GNU LGPL.
+
+  You can use, modify and/or redistribute the software under the terms of any
+  of these licences, which should have been provided to you together with this
+  sofware. If that is not the case, you can find a copy of the licences on
+  the indicated web sites.
+
+  By Nicolas . Brodu @ Inria . fr
+
+  See http://nicolas.brodu.net/programmation/amuencha/ for more information
+*/
+
+#ifndef BOUNDED_QUEUE_H
+#define BOUNDED_QUEUE_H
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+// Blocking queue between two pipeline stages. The producer waits when the
+// queue is full, so a fast stage cannot run arbitrarily far ahead of a slow
+// one, and the consumer waits until data arrives or the queue is closed.
+template<typename T>
+class Bounded_Queue
+{
+public:
+    explicit Bounded_Queue(size_t capacity) : capacity(capacity) {}
+
+    // Returns false if the queue was closed, the item is then dropped
+    bool push(const T& item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_full.wait(lock, [this]() {return items.size()<capacity || closed;});
+        if (closed) return false;
+        items.push_back(item);
+        not_empty.notify_one();
+        return true;
+    }
+
+    // Returns false once the queue is closed and all items were consumed
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_empty.wait(lock, [this]() {return !items.empty() || closed;});
+        if (items.empty()) return false;
+        item = items.front();
+        items.pop_front();
+        not_full.notify_one();
+        return true;
+    }
+
+    // No more items will be pushed. Waiting consumers get the remaining ones, then false
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        not_empty.notify_all();
+        not_full.notify_all();
+    }
+
+    void reopen() {
+        std::lock_guard<std::mutex> lock(mutex);
+        items.clear();
+        closed = false;
+    }
+
+protected:
+    const size_t capacity;
+    std::deque<T> items;
+    bool closed = false;
+    std::mutex mutex;
+    std::condition_variable not_full, not_empty;
+};
+
+#endif // BOUNDED_QUEUE_H
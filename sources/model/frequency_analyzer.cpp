@@ -54,7 +54,7 @@ Frequency_Analyzer::~Frequency_Analyzer()
     wait(); // until run terminates
 }
 
-void Frequency_Analyzer::new_data(float *chunk, int size)
+void Frequency_Analyzer::new_data(const float *chunk, int size)
 {
     
     // producer, called from another thread. 
@@ -77,9 +77,9 @@ void Frequency_Analyzer::new_data(float *chunk, int size)
     status = HAS_NEW_DATA;
     
     // IF AND ONLY IF the thread was blocked forever, then wake it up
-    if (waiting_time != CYCLE_PERIOD) {
+    if (waiting_time == ULONG_MAX) {
         // and now resume the cyclic scheduling
-        waiting_time = CYCLE_PERIOD;
+        waiting_time = suspended ? SUSPENDED_CYCLE_PERIOD : CYCLE_PERIOD;
         condition.wakeOne();
     }
     
@@ -96,7 +96,7 @@ void Frequency_Analyzer::run()
     mutex.lock();
     
     // waiting_time is a mutex-protected info
-    waiting_time = CYCLE_PERIOD;
+    waiting_time = suspended ? SUSPENDED_CYCLE_PERIOD : CYCLE_PERIOD;
     
     // loop starts with mutex locked
     while (true) {
@@ -108,9 +108,10 @@ void Frequency_Analyzer::run()
             // Swap the chunks to a local variable, so:
             // - the class chunks becomes empty
             // - the audio thread can feed it more data while computing frequencies
-            vector<pair<float*,int>> chunks;
+            vector<pair<const float*,int>> chunks;
             chunks.swap(this->chunks);
             status = NO_DATA; // will be updated if new data indeed arrives
+            bool analyze = !suspended;
             mutex.unlock();
             
             // Now, we can take the time to do the frequency computations
@@ -140,26 +141,14 @@ void Frequency_Analyzer::run()
                 new_data_pos += c.second;
             }
 
-            // Apply the filter bank
-            float *bbend = &big_buffer[0] + big_buffer.size();
-            for (int idx=0; idx<frequencies.size(); ++idx) {
-                const auto& ws = windowed_sines[idx];
-                int wsize = ws.size();
-                float* sig = bbend - wsize;
-                v4sf acc = {0.f, 0.f, 0.f, 0.f};
-                for (int i=0; i<wsize; ++i) acc += ws[i] * sig[i];
-                float norm = acc[0]*acc[0] + acc[1]*acc[1];
-                float reassign = frequencies[idx];
-                if (norm>0) {
-                    reassign -= (acc[0] * acc[3] - acc[1] * acc[2]) * samplerate_div_2pi / norm;
-                }
-                reassigned_frequencies[idx] = reassign;
-                power_spectrum[idx] = norm * power_normalization_factors[idx];
+            if (analyze) {
+                // Apply the filter bank
+                compute_spectrum(&big_buffer[0] + big_buffer.size(), reassigned_frequencies, power_spectrum);
+                
+                // Notify our listener that new power/frequency content has arrived
+                power_handler(reassigned_frequencies, power_spectrum);
             }
             
-            // Notify our listener that new power/frequency content has arrived
-            power_handler(reassigned_frequencies, power_spectrum);
-            
             // setup can now lock and change data structures if needed
             data_mutex.unlock();
             
@@ -176,6 +165,26 @@ void Frequency_Analyzer::run()
     
 }
 
+void Frequency_Analyzer::compute_spectrum(const float* signal_end, std::vector<float>& reassigned, std::vector<float>& power) const
+{
+    reassigned.resize(frequencies.size());
+    power.resize(frequencies.size());
+    for (int idx=0; idx<frequencies.size(); ++idx) {
+        const auto& ws = windowed_sines[idx];
+        int wsize = ws.size();
+        const float* sig = signal_end - wsize;
+        v4sf acc = {0.f, 0.f, 0.f, 0.f};
+        for (int i=0; i<wsize; ++i) acc += ws[i] * sig[i];
+        float norm = acc[0]*acc[0] + acc[1]*acc[1];
+        float reassign = frequencies[idx];
+        if (norm>0) {
+            reassign -= (acc[0] * acc[3] - acc[1] * acc[2]) * samplerate_div_2pi / norm;
+        }
+        reassigned[idx] = reassign;
+        power[idx] = norm * power_normalization_factors[idx];
+    }
+}
+
 void Frequency_Analyzer::setup(float sampling_rate, const std::vector<float> &frequencies, PowerHandler handler, float periods, float max_buffer_duration)
 {
     // Block data processing while changing the data structures
@@ -261,6 +270,22 @@ void Frequency_Analyzer::setup(float sampling_rate, const std::vector<float> &fr
     data_mutex.unlock();
 }
 
+void Frequency_Analyzer::set_suspended(bool suspended)
+{
+    mutex.lock();
+    if (suspended != this->suspended) {
+        this->suspended = suspended;
+        if (waiting_time != ULONG_MAX) waiting_time = suspended ? SUSPENDED_CYCLE_PERIOD : CYCLE_PERIOD;
+        // the big buffer holds the latest signal, analyze it without waiting for more
+        if (!suspended && status != QUIT_NOW) {
+            status = HAS_NEW_DATA;
+            waiting_time = CYCLE_PERIOD;
+            condition.wakeOne();
+        }
+    }
+    mutex.unlock();
+}
+
 void Frequency_Analyzer::invalidate_samples()
 {
     mutex.lock();
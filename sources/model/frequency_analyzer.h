@@ -40,7 +40,7 @@ public:
     ~Frequency_Analyzer();
     
     // called by the RT audio thread to feed new data
-    void new_data(float *chunk, int size);
+    void new_data(const float *chunk, int size);
     
     // Arguments are: frequency bins [f,f+1), and power in each bin
     // hence the first vector size is 1 more than the second
@@ -57,6 +57,17 @@ public:
     //             Too low buffers also limit the min_freq, duration must be >= period
     void setup(float sampling_rate, const std::vector<float>& frequencies, PowerHandler handler, float periods = 20, float max_buffer_duration = 500);
     
+    // Computes the power spectrum of the signal ending just before signal_end,
+    // which must be preceded by at least get_max_window_size() samples.
+    // This is what the thread does periodically, it can also be called
+    // directly (e.g. offline on a whole song) once setup is done
+    void compute_spectrum(const float* signal_end, std::vector<float>& reassigned, std::vector<float>& power) const;
+    int get_max_window_size() const {return big_buffer.size();}
+    
+    // While suspended, the new data is still buffered but not analyzed, and
+    // the handler is not called. Resuming analyzes the buffered signal at once
+    void set_suspended(bool suspended);
+    
     // call to remove all existing chunk references
     // this may cause signal loss, but this is usually called precisely when the signal is lost...
     void invalidate_samples();
@@ -66,14 +77,18 @@ protected:
     
     // Multi-threading related variables
     static const unsigned long CYCLE_PERIOD = 20; // in milliseconds
+    // Only buffering when suspended. The chunks must still be collected well
+    // before the audio thread reuses their storage
+    static const unsigned long SUSPENDED_CYCLE_PERIOD = 200;
     QMutex mutex, data_mutex;
     QWaitCondition condition;
     enum Status {NO_DATA = 0, HAS_NEW_DATA = 1, QUIT_NOW = 2};
     Status status;
     unsigned long waiting_time = CYCLE_PERIOD;
+    bool suspended = false;
     
     // new data chunks arrived since the last periodic processing
-    std::vector<std::pair<float*,int>> chunks;
+    std::vector<std::pair<const float*,int>> chunks;
 
     // The window is the usual Kaiser with alpha=3
     static void initialize_window(std::vector<float>& window);
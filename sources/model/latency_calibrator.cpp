@@ -0,0 +1,126 @@
+/*
+  Analyseur de MUsique et ENtraînement au CHAnt
+
+  This file is released under either of the two licenses below, your choice:
+  - LGPL v2.1 or later, https://www.gnu.org
+    The GNU Lesser General Public Licence, version 2.1 or,
+    at your option, any later version.
+  - CeCILL-C, http://www.cecill.info
+    The CeCILL-C license is more adapted to the French laws,
+    but can be converted to the GNU LGPL.
+
+  You can use, modify and/or redistribute the software under the terms of any
+  of these licences, which should have been provided to you together with this
+  sofware. If that is not the case, you can find a copy of the licences on
+  the indicated web sites.
+
+  By Nicolas . Brodu @ Inria . fr
+
+  See http://nicolas.brodu.net/programmation/amuencha/ for more information
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <iostream>
+
+#include <boost/math/constants/constants.hpp>
+
+#include "latency_calibrator.h"
+
+using namespace std;
+using namespace boost::math::float_constants;
+
+namespace {
+
+// In-place iterative radix-2 FFT, size must be a power of 2
+// inverse is unnormalized
+void fft(vector<complex<float>>& data, bool inverse)
+{
+    const size_t n = data.size();
+    for (size_t i=1, j=0; i<n; ++i) {
+        size_t bit = n >> 1;
+        for (; j & bit; bit >>= 1) j ^= bit;
+        j ^= bit;
+        if (i<j) swap(data[i], data[j]);
+    }
+    for (size_t len=2; len<=n; len<<=1) {
+        double angle = (inverse ? 2 : -2) * boost::math::double_constants::pi / len;
+        complex<float> step((float)cos(angle), (float)sin(angle));
+        for (size_t i=0; i<n; i+=len) {
+            complex<float> w(1.f, 0.f);
+            for (size_t k=0; k<len/2; ++k) {
+                complex<float> u = data[i+k], v = data[i+k+len/2] * w;
+                data[i+k] = u + v;
+                data[i+k+len/2] = u - v;
+                w *= step;
+            }
+        }
+    }
+}
+
+}
+
+Latency_Calibrator::Latency_Calibrator(int sample_rate)
+: sample_rate(sample_rate)
+{
+    lead_in = (int)(lead_in_duration * sample_rate);
+    max_latency = (int)(max_latency_duration * sample_rate);
+
+    // exponential sweep, with short fades against clicks
+    int n = (int)(chirp_duration * sample_rate);
+    float f0 = 200.f, f1 = min(8000.f, 0.4f * sample_rate);
+    float k = log(f1 / f0);
+    int fade = sample_rate / 100;
+    chirp.resize(n);
+    for (int i=0; i<n; ++i) {
+        float t = (float)i / sample_rate;
+        float phase = two_pi * f0 * chirp_duration / k * (exp(t / chirp_duration * k) - 1.f);
+        float envelope = min(1.f, min((float)i / fade, (float)(n-1-i) / fade));
+        chirp[i] = 0.5f * envelope * sin(phase);
+    }
+    capture.assign(lead_in + n + max_latency, 0.f);
+}
+
+void Latency_Calibrator::process(const float* input, int count, float* output)
+{
+    int64_t pos = position;
+    for (int i=0; i<count; ++i, ++pos) {
+        int64_t c = pos - lead_in;
+        output[i] = (c>=0 && c<(int64_t)chirp.size()) ? chirp[c] : 0.f;
+        if (pos<(int64_t)capture.size()) capture[pos] = input ? input[i] : 0.f;
+    }
+    position = min(pos, (int64_t)capture.size());
+    if (position==(int64_t)capture.size()) finished = true;
+}
+
+int Latency_Calibrator::estimate() const
+{
+    if (!finished) return -1;
+    size_t n = 1;
+    while (n < capture.size() + chirp.size()) n <<= 1;
+    vector<complex<float>> x(n), s(n);
+    for (size_t i=0; i<capture.size(); ++i) x[i] = capture[i];
+    for (size_t i=0; i<chirp.size(); ++i) s[i] = chirp[i];
+    fft(x, false);
+    fft(s, false);
+    // correlation[m] = sum_k capture[k+m] chirp[k]
+    for (size_t i=0; i<n; ++i) x[i] *= conj(s[i]);
+    fft(x, true);
+
+    // the polarity may be inverted by the lines, look for the absolute peak
+    int best = -1;
+    float peak = 0;
+    double energy = 0;
+    for (int m=lead_in; m<lead_in+max_latency; ++m) {
+        float v = fabs(x[m].real());
+        energy += (double)v * v;
+        if (v>peak) {
+            peak = v;
+            best = m;
+        }
+    }
+    float rms = (float)sqrt(energy / max_latency);
+    if (best<0 || peak < min_peak_ratio * rms) return -1;
+    return best - lead_in;
+}
@@ -0,0 +1,67 @@
+/*
+  Analyseur de MUsique et ENtraînement au CHAnt
+
+  This file is released under either of the two licenses below, your choice:
+  - LGPL v2.1 or later, https://www.gnu.org
+    The GNU Lesser General Public Licence, version 2.1 or,
+    at your option, any later version.
+  - CeCILL-C, http://www.cecill.info
+    The CeCILL-C license is more adapted to the French laws,
+    but can be converted to the GNU LGPL.
+
+  You can use, modify and/or redistribute the software under the terms of any
+  of these licences, which should have been provided to you together with this
+  sofware. If that is not the case, you can find a copy of the licences on
+  the indicated web sites.
+
+  By Nicolas . Brodu @ Inria . fr
+
+  See http://nicolas.brodu.net/programmation/amuencha/ for more information
+*/
+
+#ifndef LATENCY_CALIBRATOR_H
+#define LATENCY_CALIBRATOR_H
+
+#include <vector>
+#include <atomic>
+#include <cstdint>
+
+// Measures the round-trip latency of the audio lines: a logarithmic chirp is
+// played on the output and captured back on the input, through the air or a
+// loopback cable, then located in the capture by FFT cross-correlation.
+// The capture buffer is allocated beforehand, so process() can run in the
+// audio callback.
+class Latency_Calibrator
+{
+public:
+    explicit Latency_Calibrator(int sample_rate);
+
+    // Audio thread. Captures count input samples (null input is silence)
+    // and writes the test signal in the mono output
+    void process(const float* input, int count, float* output);
+    bool is_finished() const {return finished;}
+    // between 0 and 1
+    float get_progress() const {return (float)position / capture.size();}
+
+    // Once finished, the round-trip latency in frames, or -1 when the test
+    // signal could not be found clearly in the capture
+    int estimate() const;
+
+protected:
+    // in seconds
+    static constexpr float lead_in_duration = 0.1f;
+    static constexpr float chirp_duration = 0.5f;
+    static constexpr float max_latency_duration = 1.0f;
+    // peak over the RMS of the correlation, below this the result is rejected
+    static constexpr float min_peak_ratio = 8.f;
+
+    int sample_rate;
+    int lead_in;
+    int max_latency;
+    std::vector<float> chirp;
+    std::vector<float> capture;
+    std::atomic<int64_t> position {0};
+    std::atomic<bool> finished {false};
+};
+
+#endif // LATENCY_CALIBRATOR_H
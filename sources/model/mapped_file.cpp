@@ -0,0 +1,126 @@
+/*
+  Analyseur de MUsique et ENtraînement au CHAnt
+
+  This file is released under either of the two licenses below, your choice:
+  - LGPL v2.1 or later, https://www.gnu.org
+    The GNU Lesser General Public Licence, version 2.1 or,
+    at your option, any later version.
+  - CeCILL-C, http://www.cecill.info
+    The CeCILL-C license is more adapted to the French laws,
+    but can be converted to the GNU LGPL.
+
+  You can use, modify and/or redistribute the software under the terms of any
+  of these licences, which should have been provided to you together with this
+  sofware. If that is not the case, you can find a copy of the licences on
+  the indicated web sites.
+
+  By Nicolas . Brodu @ Inria . fr
+
+  See http://nicolas.brodu.net/programmation/amuencha/ for more information
+*/
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+
+#include "mapped_file.h"
+
+using namespace std;
+
+Mapped_File::~Mapped_File()
+{
+    close();
+}
+
+#if defined(_WIN32) || defined(_WIN64)
+
+bool Mapped_File::open(const std::string& filename)
+{
+    close();
+    // the take being recorded is still open for writing
+    file_handle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file_handle==INVALID_HANDLE_VALUE) {
+        file_handle = 0;
+        return false;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file_handle, &size) || size.QuadPart==0) {
+        close();
+        return false;
+    }
+    mapping_handle = CreateFileMapping(file_handle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!mapping_handle) {
+        close();
+        return false;
+    }
+    data_ptr = (const char*)MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0);
+    if (!data_ptr) {
+        close();
+        return false;
+    }
+    data_size = size.QuadPart;
+    return true;
+}
+
+void Mapped_File::close()
+{
+    if (data_ptr) UnmapViewOfFile(data_ptr);
+    if (mapping_handle) CloseHandle(mapping_handle);
+    if (file_handle) CloseHandle(file_handle);
+    data_ptr = 0;
+    data_size = 0;
+    mapping_handle = 0;
+    file_handle = 0;
+}
+
+void Mapped_File::prefetch(size_t offset, size_t length) const
+{
+    // Windows reads ahead on its own on sequential accesses
+}
+
+#else
+
+bool Mapped_File::open(const std::string& filename)
+{
+    close();
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd<0) return false;
+    struct stat st;
+    if (fstat(fd, &st)<0 || st.st_size==0) {
+        ::close(fd);
+        return false;
+    }
+    void* ptr = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    // the mapping stays valid after closing the descriptor
+    ::close(fd);
+    if (ptr==MAP_FAILED) return false;
+    data_ptr = (const char*)ptr;
+    data_size = st.st_size;
+    return true;
+}
+
+void Mapped_File::close()
+{
+    if (data_ptr) munmap(const_cast<char*>(data_ptr), data_size);
+    data_ptr = 0;
+    data_size = 0;
+}
+
+void Mapped_File::prefetch(size_t offset, size_t length) const
+{
+    if (!data_ptr || offset>=data_size) return;
+    // madvise wants page-aligned addresses
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t start = offset / page * page;
+    size_t end = min(data_size, offset + length);
+    madvise(const_cast<char*>(data_ptr) + start, end - start, MADV_WILLNEED);
+}
+
+#endif
@@ -0,0 +1,58 @@
+/*
+  Analyseur de MUsique et ENtraînement au CHAnt
+
+  This file is released under either of the two licenses below, your choice:
+  - LGPL v2.1 or later, https://www.gnu.org
+    The GNU Lesser General Public Licence, version 2.1 or,
+    at your option, any later version.
+  - CeCILL-C, http://www.cecill.info
+    The CeCILL-C license is more adapted to the French laws,
+    but can be converted to the GNU LGPL.
+
+  You can use, modify and/or redistribute the software under the terms of any
+  of these licences, which should have been provided to you together with this
+  sofware. If that is not the case, you can find a copy of the licences on
+  the indicated web sites.
+
+  By Nicolas . Brodu @ Inria . fr
+
+  See http://nicolas.brodu.net/programmation/amuencha/ for more information
+*/
+
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <string>
+#include <cstddef>
+
+// Read-only memory mapping of a whole file. Pages are faulted in lazily by
+// the OS when accessed, and shared with the page cache instead of being
+// copied on the heap.
+class Mapped_File
+{
+public:
+    Mapped_File() {}
+    ~Mapped_File();
+    Mapped_File(const Mapped_File&) = delete;
+    Mapped_File& operator=(const Mapped_File&) = delete;
+
+    bool open(const std::string& filename);
+    void close();
+
+    bool is_open() const {return data_ptr!=0;}
+    const char* data() const {return data_ptr;}
+    size_t size() const {return data_size;}
+
+    // Hint that the given range will be needed soon, so the OS starts reading it
+    void prefetch(size_t offset, size_t length) const;
+
+protected:
+    const char* data_ptr = 0;
+    size_t data_size = 0;
+#if defined(_WIN32) || defined(_WIN64)
+    void* file_handle = 0;
+    void* mapping_handle = 0;
+#endif
+};
+
+#endif // MAPPED_FILE_H
@@ -0,0 +1,120 @@
+/*
+  Analyseur de MUsique et ENtraînement au CHAnt
+
+  This file is released under either of the two licenses below, your choice:
+  - LGPL v2.1 or later, https://www.gnu.org
+    The GNU Lesser General Public Licence, version 2.1 or,
+    at your option, any later version.
+  - CeCILL-C, http://www.cecill.info
+    The CeCILL-C license is more adapted to the French laws,
+    but can be converted to the GNU LGPL.
+
+  You can use, modify and/or redistribute the software under the terms of any
+  of these licences, which should have been provided to you together with this
+  sofware. If that is not the case, you can find a copy of the licences on
+  the indicated web sites.
+
+  By Nicolas . Brodu @ Inria . fr
+
+  See http://nicolas.brodu.net/programmation/amuencha/ for more information
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#include "offline_audio.h"
+
+using namespace std;
+
+bool Offline_Audio_Driver::open_input(const std::string& source, int sample_rate)
+{
+    position = 0;
+    noise_state = 1;
+    this->sample_rate = sample_rate;
+    if (source=="silence") generator = SILENCE;
+    else if (source=="noise") generator = NOISE;
+    else if (source.compare(0, 5, "sine:")==0 || source.compare(0, 6, "chord:")==0) {
+        generator = (source[0]=='s') ? SINE : CHORD;
+        frequency = atof(source.c_str() + source.find(':') + 1);
+        if (frequency<=0) return false;
+    }
+    else {
+        generator = FILE_INPUT;
+        if (!input_file.open(source)) return false;
+        this->sample_rate = input_file.get_sample_rate();
+    }
+    return this->sample_rate>0;
+}
+
+bool Offline_Audio_Driver::open_output(const std::string& filename)
+{
+    return output_file.open(filename, sample_rate, 2);
+}
+
+int64_t Offline_Audio_Driver::get_input_frames() const
+{
+    return generator==FILE_INPUT ? input_file.get_num_frames() : -1;
+}
+
+void Offline_Audio_Driver::fill_input(float* input, int count)
+{
+    const double two_pi = 6.283185307179586;
+    switch (generator) {
+        case FILE_INPUT: {
+            int available = (int)max((int64_t)0, min((int64_t)count, input_file.get_num_frames() - position));
+            if (available>0) input_file.read_mono(position, available, input);
+            fill(input + available, input + count, 0.f);
+            break;
+        }
+        case SILENCE:
+            fill(input, input + count, 0.f);
+            break;
+        case NOISE:
+            // same sequence on every run
+            for (int i=0; i<count; ++i) {
+                noise_state = noise_state * 1664525u + 1013904223u;
+                input[i] = ((int32_t)noise_state) * (0.25f / 2147483648.f);
+            }
+            break;
+        case SINE:
+            for (int i=0; i<count; ++i) input[i] = 0.5f * sin(two_pi * frequency * (position + i) / sample_rate);
+            break;
+        case CHORD:
+            // root, major third and fifth, like the test sinusoids in the callback
+            for (int i=0; i<count; ++i) {
+                double t = two_pi * frequency * (position + i) / sample_rate;
+                input[i] = (float)((sin(t) + sin(t * 5 / 4) + sin(t * 3 / 2)) / 6);
+            }
+            break;
+    }
+}
+
+Offline_Audio_Driver::Stats Offline_Audio_Driver::run(Callback callback, void* user_data, unsigned int num_frames, int64_t duration,
+                                                      const std::function<void()>& between_buffers)
+{
+    Stats stats;
+    if (duration<0) duration = max((int64_t)0, get_input_frames());
+    vector<float> input(num_frames), output(num_frames * 2);
+    chrono::steady_clock::duration total(0);
+    while (stats.num_frames<duration && !stop_requested) {
+        fill_input(&input[0], num_frames);
+        auto start = chrono::steady_clock::now();
+        callback(&output[0], &input[0], num_frames, (double)position / sample_rate, 0, user_data);
+        auto elapsed = chrono::steady_clock::now() - start;
+        total += elapsed;
+        stats.max_callback_ms = max(stats.max_callback_ms, chrono::duration<double, milli>(elapsed).count());
+        position += num_frames;
+        // the last buffer may be partial
+        int kept = (int)min((int64_t)num_frames, duration - stats.num_frames);
+        if (output_file.is_open()) output_file.write(&output[0], kept * 2);
+        stats.num_frames += kept;
+        ++stats.num_callbacks;
+        if (between_buffers) between_buffers();
+    }
+    output_file.close();
+    stats.callback_seconds = chrono::duration<double>(total).count();
+    return stats;
+}
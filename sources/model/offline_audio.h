@@ -0,0 +1,86 @@
+/*
+  Analyseur de MUsique et ENtraînement au CHAnt
+
+  This file is released under either of the two licenses below, your choice:
+  - LGPL v2.1 or later, https://www.gnu.org
+    The GNU Lesser General Public Licence, version 2.1 or,
+    at your option, any later version.
+  - CeCILL-C, http://www.cecill.info
+    The CeCILL-C license is more adapted to the French laws,
+    but can be converted to the GNU LGPL.
+
+  You can use, modify and/or redistribute the software under the terms of any
+  of these licences, which should have been provided to you together with this
+  sofware. If that is not the case, you can find a copy of the licences on
+  the indicated web sites.
+
+  By Nicolas . Brodu @ Inria . fr
+
+  See http://nicolas.brodu.net/programmation/amuencha/ for more information
+*/
+
+#ifndef OFFLINE_AUDIO_H
+#define OFFLINE_AUDIO_H
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <atomic>
+#include <cstdint>
+
+#include "pcm_file.h"
+
+// Drives an audio callback with the RtAudio signature in a tight loop,
+// faster than real time, without any sound card: the mono input comes from
+// a WAV file or a deterministic signal generator, and the interleaved
+// stereo output is captured to a WAV file.
+// Meant for reproducible throughput benchmarks and regression runs.
+class Offline_Audio_Driver
+{
+public:
+    // Same layout as RtAudioCallback, the status is always 0
+    typedef int (*Callback)(void* output, void* input, unsigned int num_frames,
+                            double stream_time, unsigned int status, void* user_data);
+
+    struct Stats {
+        int64_t num_frames = 0;
+        int64_t num_callbacks = 0;
+        double callback_seconds = 0;
+        double max_callback_ms = 0;
+    };
+
+    // source is a WAV/AIFF file name, or one of the generators:
+    // "silence", "noise", "sine:<Hz>", "chord:<Hz>" (major triad on that root)
+    // Files impose their sample rate, generators use the given one
+    bool open_input(const std::string& source, int sample_rate);
+    // Optional, the output is discarded otherwise
+    bool open_output(const std::string& filename);
+
+    int get_sample_rate() const {return sample_rate;}
+    // Input length in frames, or -1 for the generators
+    int64_t get_input_frames() const;
+
+    // Calls the callback with buffers of num_frames, until duration frames
+    // were processed (the end of the input file when duration<0)
+    // between_buffers, if set, runs after each callback, outside the timing
+    Stats run(Callback callback, void* user_data, unsigned int num_frames, int64_t duration,
+              const std::function<void()>& between_buffers = std::function<void()>());
+    // Any thread. run returns after the current buffer
+    void stop() {stop_requested = true;}
+
+protected:
+    enum Generator {FILE_INPUT, SILENCE, NOISE, SINE, CHORD};
+
+    void fill_input(float* input, int count);
+
+    Generator generator = SILENCE;
+    double frequency = 440;
+    int sample_rate = 0;
+    int64_t position = 0;
+    std::atomic<bool> stop_requested {false};
+    uint32_t noise_state = 1;
+    PCM_Reader input_file;
+    WAV_Writer output_file;
+};
+
+#endif // OFFLINE_AUDIO_H
@@ -0,0 +1,368 @@
+/*
+  Analyseur de MUsique et ENtraînement au CHAnt
+
+  This file is released under either of the two licenses below, your choice:
+  - LGPL v2.1 or later, https://www.gnu.org
+    The GNU Lesser General Public Licence, version 2.1 or,
+    at your option, any later version.
+  - CeCILL-C, http://www.cecill.info
+    The CeCILL-C license is more adapted to the French laws,
+    but can be converted to the GNU LGPL.
+
+  You can use, modify and/or redistribute the software under the terms of any
+  of these licences, which should have been provided to you together with this
+  sofware. If that is not the case, you can find a copy of the licences on
+  the indicated web sites.
+
+  By Nicolas . Brodu @ Inria . fr
+
+  See http://nicolas.brodu.net/programmation/amuencha/ for more information
+*/
+
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+#include "pcm_file.h"
+
+using namespace std;
+
+namespace {
+
+typedef float v4sf __attribute__ ((vector_size (16)));
+typedef float v8sf __attribute__ ((vector_size (32)));
+typedef int16_t v8hi __attribute__ ((vector_size (16)));
+typedef int32_t v8si __attribute__ ((vector_size (32)));
+
+const bool host_big_endian = (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__);
+
+uint16_t read_u16(const char* p, bool big_endian) {
+    const uint8_t* b = (const uint8_t*)p;
+    return big_endian ? (b[0]<<8 | b[1]) : (b[1]<<8 | b[0]);
+}
+
+uint32_t read_u32(const char* p, bool big_endian) {
+    const uint8_t* b = (const uint8_t*)p;
+    return big_endian ? ((uint32_t)b[0]<<24 | b[1]<<16 | b[2]<<8 | b[3])
+                      : ((uint32_t)b[3]<<24 | b[2]<<16 | b[1]<<8 | b[0]);
+}
+
+void write_u16_le(char* p, uint16_t v) {
+    p[0] = (char)(v & 0xFF); p[1] = (char)(v>>8);
+}
+
+void write_u32_le(char* p, uint32_t v) {
+    for (int i=0; i<4; ++i) p[i] = (char)((v>>(i*8)) & 0xFF);
+}
+
+uint64_t read_u64_le(const char* p) {
+    return (uint64_t)read_u32(p+4, false)<<32 | read_u32(p, false);
+}
+
+// The 80-bit IEEE extended float used by AIFF for the sampling rate
+double read_extended(const char* p) {
+    const uint8_t* b = (const uint8_t*)p;
+    int exponent = ((b[0]&0x7F)<<8 | b[1]) - 16383;
+    uint64_t mantissa = 0;
+    for (int i=2; i<10; ++i) mantissa = mantissa<<8 | b[i];
+    double value = ldexp((double)mantissa, exponent - 63);
+    return (b[0]&0x80) ? -value : value;
+}
+
+// One sample of any supported encoding, scaled to [-1,1]
+float decode_sample(const char* p, PCM_Reader::Encoding encoding, bool big_endian) {
+    const uint8_t* b = (const uint8_t*)p;
+    switch (encoding) {
+        case PCM_Reader::UINT8: return (b[0] - 128) * (1.f/128.f);
+        case PCM_Reader::INT16: return (int16_t)read_u16(p, big_endian) * (1.f/32768.f);
+        case PCM_Reader::INT24: {
+            uint32_t u = big_endian ? ((uint32_t)b[0]<<24 | (uint32_t)b[1]<<16 | (uint32_t)b[2]<<8)
+                                    : ((uint32_t)b[2]<<24 | (uint32_t)b[1]<<16 | (uint32_t)b[0]<<8);
+            int32_t v = (int32_t)u;
+            return v * (1.f/2147483648.f);
+        }
+        case PCM_Reader::INT32: return (int32_t)read_u32(p, big_endian) * (1.f/2147483648.f);
+        case PCM_Reader::FLOAT32: {
+            uint32_t u = read_u32(p, big_endian);
+            float f;
+            memcpy(&f, &u, sizeof(f));
+            return f;
+        }
+        case PCM_Reader::FLOAT64: {
+            uint64_t u = big_endian ? ((uint64_t)read_u32(p, true)<<32 | read_u32(p+4, true)) : read_u64_le(p);
+            double d;
+            memcpy(&d, &u, sizeof(d));
+            return (float)d;
+        }
+    }
+    return 0;
+}
+
+}
+
+bool PCM_Reader::open(const std::string& filename)
+{
+    mapping = make_shared<Mapped_File>();
+    if (!mapping->open(filename) || mapping->size()<12) return false;
+    const char* d = mapping->data();
+    bool ok = false;
+    if (!memcmp(d, "RIFF", 4) && !memcmp(d+8, "WAVE", 4)) ok = parse_riff(false);
+    else if (!memcmp(d, "RF64", 4) && !memcmp(d+8, "WAVE", 4)) ok = parse_riff(true);
+    else if (!memcmp(d, "FORM", 4) && !memcmp(d+8, "AIFF", 4)) ok = parse_aiff(false);
+    else if (!memcmp(d, "FORM", 4) && !memcmp(d+8, "AIFC", 4)) ok = parse_aiff(true);
+    if (!ok || channels<=0 || sample_rate<=0 || num_frames<=0) {
+        mapping.reset();
+        return false;
+    }
+    // Never trust the sizes in the header beyond the file end
+    int64_t available = (mapping->size() - data_offset) / (bytes_per_sample * channels);
+    num_frames = min(num_frames, available);
+    return num_frames>0;
+}
+
+bool PCM_Reader::parse_riff(bool rf64)
+{
+    const char* d = mapping->data();
+    const size_t size = mapping->size();
+    uint64_t ds64_data_size = 0;
+    int format_tag = 0, bits = 0;
+    bool has_fmt = false;
+    size_t pos = 12;
+    while (pos + 8 <= size) {
+        const char* chunk = d + pos;
+        uint64_t chunk_size = read_u32(chunk+4, false);
+        // the fields of a chunk are only read when it lies entirely in the file
+        // only the sample data may be truncated
+        const bool complete = chunk_size <= size - pos - 8;
+        if (!memcmp(chunk, "ds64", 4) && rf64 && chunk_size>=24 && complete) {
+            ds64_data_size = read_u64_le(chunk+16);
+        }
+        else if (!memcmp(chunk, "fmt ", 4) && chunk_size>=16 && complete) {
+            format_tag = read_u16(chunk+8, false);
+            channels = read_u16(chunk+10, false);
+            sample_rate = read_u32(chunk+12, false);
+            bits = read_u16(chunk+22, false);
+            // WAVE_FORMAT_EXTENSIBLE: the real format is the start of the sub-format GUID
+            if (format_tag==0xFFFE && chunk_size>=40) format_tag = read_u16(chunk+32, false);
+            has_fmt = true;
+        }
+        else if (!memcmp(chunk, "data", 4)) {
+            if (!has_fmt) return false;
+            if (rf64 && chunk_size==0xFFFFFFFF) chunk_size = ds64_data_size;
+            data_offset = pos + 8;
+            if (format_tag==1) {
+                if (bits==8) encoding = UINT8;
+                else if (bits==16) encoding = INT16;
+                else if (bits==24) encoding = INT24;
+                else if (bits==32) encoding = INT32;
+                else return false;
+            }
+            else if (format_tag==3) {
+                if (bits==32) encoding = FLOAT32;
+                else if (bits==64) encoding = FLOAT64;
+                else return false;
+            }
+            else return false; // compressed, leave it to libav
+            bytes_per_sample = bits / 8;
+            if (channels<=0) return false;
+            big_endian = false;
+            // 0 happens for streamed files whose header was never updated
+            if (chunk_size==0) chunk_size = size - data_offset;
+            num_frames = chunk_size / (bytes_per_sample * channels);
+            return true;
+        }
+        // chunks are padded to even sizes
+        pos += 8 + chunk_size + (chunk_size & 1);
+    }
+    return false;
+}
+
+bool PCM_Reader::parse_aiff(bool aifc)
+{
+    const char* d = mapping->data();
+    const size_t size = mapping->size();
+    int bits = 0;
+    bool has_comm = false;
+    size_t pos = 12;
+    while (pos + 8 <= size) {
+        const char* chunk = d + pos;
+        uint64_t chunk_size = read_u32(chunk+4, true);
+        // the fields of a chunk are only read when it lies entirely in the file
+        // only the sample data may be truncated
+        const bool complete = chunk_size <= size - pos - 8;
+        if (!memcmp(chunk, "COMM", 4) && chunk_size>=18 && complete) {
+            channels = read_u16(chunk+8, true);
+            num_frames = read_u32(chunk+10, true);
+            bits = read_u16(chunk+14, true);
+            sample_rate = (int)lrint(read_extended(chunk+16));
+            big_endian = true;
+            if (bits<=8) encoding = UINT8;
+            else if (bits<=16) encoding = INT16;
+            else if (bits<=24) encoding = INT24;
+            else encoding = INT32;
+            if (aifc && chunk_size>=22) {
+                const char* compression = chunk+26;
+                if (!memcmp(compression, "sowt", 4)) big_endian = false;
+                else if (!memcmp(compression, "fl32", 4) || !memcmp(compression, "FL32", 4)) {encoding = FLOAT32; bits = 32;}
+                else if (!memcmp(compression, "fl64", 4) || !memcmp(compression, "FL64", 4)) {encoding = FLOAT64; bits = 64;}
+                else if (memcmp(compression, "NONE", 4) && memcmp(compression, "twos", 4)) return false;
+            }
+            // AIFF 8-bit samples are signed, unlike WAV
+            if (encoding==UINT8 || channels<=0) return false;
+            bytes_per_sample = (bits + 7) / 8;
+            has_comm = true;
+        }
+        else if (!memcmp(chunk, "SSND", 4) && chunk_size>=8 && pos + 16 <= size) {
+            if (!has_comm) return false;
+            data_offset = pos + 16 + read_u32(chunk+8, true);
+            return data_offset < size;
+        }
+        pos += 8 + chunk_size + (chunk_size & 1);
+    }
+    return false;
+}
+
+bool PCM_Reader::is_native_mono_float() const
+{
+    return channels==1 && encoding==FLOAT32 && big_endian==host_big_endian && data_offset % sizeof(float)==0;
+}
+
+void PCM_Reader::read_mono(int64_t first, int count, float* out) const
+{
+    const char* src = mapping->data() + data_offset + first * channels * bytes_per_sample;
+    const bool native = (big_endian==host_big_endian);
+    int i = 0;
+
+    // Vectorized paths for the common cases, native 16-bit integers and floats, mono or stereo
+    if (native && encoding==INT16 && channels==1) {
+        const v8sf scale = {1.f/32768.f, 1.f/32768.f, 1.f/32768.f, 1.f/32768.f, 1.f/32768.f, 1.f/32768.f, 1.f/32768.f, 1.f/32768.f};
+        for (; i+8<=count; i+=8) {
+            v8hi m;
+            memcpy(&m, src + i*2, sizeof(m));
+            v8sf f = __builtin_convertvector(__builtin_convertvector(m, v8si), v8sf) * scale;
+            memcpy(out + i, &f, sizeof(f));
+        }
+    }
+    else if (native && encoding==INT16 && channels==2) {
+        // 4 frames at a time, the average of left and right
+        const v4sf scale = {0.5f/32768.f, 0.5f/32768.f, 0.5f/32768.f, 0.5f/32768.f};
+        for (; i+4<=count; i+=4) {
+            v8hi m;
+            memcpy(&m, src + i*4, sizeof(m));
+            v8sf f = __builtin_convertvector(__builtin_convertvector(m, v8si), v8sf);
+            v4sf left = {f[0], f[2], f[4], f[6]};
+            v4sf right = {f[1], f[3], f[5], f[7]};
+            v4sf mono = (left + right) * scale;
+            memcpy(out + i, &mono, sizeof(mono));
+        }
+    }
+    else if (native && encoding==FLOAT32 && channels==1) {
+        memcpy(out, src, count*sizeof(float));
+        return;
+    }
+    else if (native && encoding==FLOAT32 && channels==2) {
+        const v4sf half = {0.5f, 0.5f, 0.5f, 0.5f};
+        for (; i+4<=count; i+=4) {
+            v8sf f;
+            memcpy(&f, src + i*8, sizeof(f));
+            v4sf left = {f[0], f[2], f[4], f[6]};
+            v4sf right = {f[1], f[3], f[5], f[7]};
+            v4sf mono = (left + right) * half;
+            memcpy(out + i, &mono, sizeof(mono));
+        }
+    }
+
+    // Generic path for the remaining frames and the other formats
+    const float inv_channels = 1.f / channels;
+    const int frame_bytes = channels * bytes_per_sample;
+    for (; i<count; ++i) {
+        const char* frame = src + i * frame_bytes;
+        float sum = 0;
+        for (int c=0; c<channels; ++c) sum += decode_sample(frame + c*bytes_per_sample, encoding, big_endian);
+        out[i] = sum * inv_channels;
+    }
+}
+
+bool WAV_Writer::open(const std::string& filename, int sample_rate, int channels)
+{
+    close();
+    this->filename = filename;
+    this->sample_rate = sample_rate;
+    this->channels = channels;
+    num_samples = 0;
+    pending.clear();
+    pending.reserve(write_block_size);
+    file.open(filename, ios::binary|ios::trunc);
+    if (!file.is_open()) return false;
+    return sync();
+}
+
+void WAV_Writer::write(const float* samples, int64_t count)
+{
+    while (count>0) {
+        int64_t n = min(count, (int64_t)(write_block_size - pending.size()));
+        pending.insert(pending.end(), samples, samples+n);
+        samples += n;
+        count -= n;
+        if ((int)pending.size()==write_block_size) {
+            // WAV data is little endian, like the x86 and ARM hosts
+            file.write((const char*)&pending[0], pending.size()*sizeof(float));
+            num_samples += pending.size();
+            pending.clear();
+        }
+    }
+}
+
+bool WAV_Writer::sync()
+{
+    if (!file.is_open()) return false;
+    if (!pending.empty()) {
+        file.write((const char*)&pending[0], pending.size()*sizeof(float));
+        num_samples += pending.size();
+        pending.clear();
+    }
+    // IEEE float format. A JUNK chunk reserves the room of a ds64 chunk, so
+    // that the file turns into RF64 in place when its size outgrows 32 bits
+    const int64_t data_size = num_samples * (int64_t)sizeof(float);
+    const int64_t riff_size = data_size + header_size - 8;
+    const bool rf64 = riff_size > 0xFFFFFFFFLL;
+    char header[header_size];
+    memset(header, 0, sizeof(header));
+    memcpy(header, rf64 ? "RF64" : "RIFF", 4);
+    write_u32_le(header+4, rf64 ? 0xFFFFFFFF : (uint32_t)riff_size);
+    memcpy(header+8, "WAVE", 4);
+    memcpy(header+12, rf64 ? "ds64" : "JUNK", 4);
+    write_u32_le(header+16, 28);
+    if (rf64) {
+        write_u32_le(header+20, (uint32_t)riff_size);
+        write_u32_le(header+24, (uint32_t)(riff_size>>32));
+        write_u32_le(header+28, (uint32_t)data_size);
+        write_u32_le(header+32, (uint32_t)(data_size>>32));
+        write_u32_le(header+36, (uint32_t)(num_samples / channels));
+        write_u32_le(header+40, (uint32_t)((num_samples / channels)>>32));
+        // no table of other chunk sizes
+    }
+    memcpy(header+48, "fmt ", 4);
+    write_u32_le(header+52, 16);
+    write_u16_le(header+56, 3);
+    write_u16_le(header+58, channels);
+    write_u32_le(header+60, sample_rate);
+    write_u32_le(header+64, sample_rate * channels * sizeof(float));
+    write_u16_le(header+68, channels * sizeof(float));
+    write_u16_le(header+70, 32);
+    memcpy(header+72, "data", 4);
+    write_u32_le(header+76, rf64 ? 0xFFFFFFFF : (uint32_t)data_size);
+    streampos end = file.tellp();
+    file.seekp(0);
+    file.write(header, sizeof(header));
+    if (end>(streampos)sizeof(header)) file.seekp(end);
+    file.flush();
+    return file.good();
+}
+
+void WAV_Writer::close()
+{
+    if (!file.is_open()) return;
+    sync();
+    file.close();
+}
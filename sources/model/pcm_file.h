@@ -0,0 +1,105 @@
+/*
+  Analyseur de MUsique et ENtraînement au CHAnt
+
+  This file is released under either of the two licenses below, your choice:
+  - LGPL v2.1 or later, https://www.gnu.org
+    The GNU Lesser General Public Licence, version 2.1 or,
+    at your option, any later version.
+  - CeCILL-C, http://www.cecill.info
+    The CeCILL-C license is more adapted to the French laws,
+    but can be converted to the GNU LGPL.
+
+  You can use, modify and/or redistribute the software under the terms of any
+  of these licences, which should have been provided to you together with this
+  sofware. If that is not the case, you can find a copy of the licences on
+  the indicated web sites.
+
+  By Nicolas . Brodu @ Inria . fr
+
+  See http://nicolas.brodu.net/programmation/amuencha/ for more information
+*/
+
+#ifndef PCM_FILE_H
+#define PCM_FILE_H
+
+#include <string>
+#include <memory>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+
+#include "mapped_file.h"
+
+// Uncompressed PCM audio files (WAV, RF64, AIFF and AIFF-C), read straight
+// from a memory mapping without going through libav
+class PCM_Reader
+{
+public:
+    enum Encoding {UINT8, INT16, INT24, INT32, FLOAT32, FLOAT64};
+
+    // Returns false when the file is not an uncompressed PCM file
+    // that this class can read (then libav is the fallback)
+    bool open(const std::string& filename);
+
+    int get_channels() const {return channels;}
+    int get_sample_rate() const {return sample_rate;}
+    int64_t get_num_frames() const {return num_frames;}
+
+    // true when the samples are already in the song format: mono native floats,
+    // aligned so they can be used in place
+    bool is_native_mono_float() const;
+    const std::shared_ptr<Mapped_File>& get_mapping() const {return mapping;}
+    size_t get_data_offset() const {return data_offset;}
+
+    // Converts count frames starting at first to mono floats, averaging the channels
+    void read_mono(int64_t first, int count, float* out) const;
+
+protected:
+    bool parse_riff(bool rf64);
+    bool parse_aiff(bool aifc);
+
+    std::shared_ptr<Mapped_File> mapping;
+    size_t data_offset = 0;
+    int channels = 0;
+    int sample_rate = 0;
+    int64_t num_frames = 0;
+    Encoding encoding = INT16;
+    int bytes_per_sample = 2;
+    bool big_endian = false;
+};
+
+// Float WAV file, written in large sequential blocks
+// It becomes an RF64 file once past the 4GB limit of the RIFF sizes
+// The header sizes are only valid after sync() or close(), until then
+// readers must not trust the file length
+class WAV_Writer
+{
+public:
+    ~WAV_Writer() {close();}
+
+    bool open(const std::string& filename, int sample_rate, int channels = 1);
+    bool is_open() const {return file.is_open();}
+    const std::string& get_filename() const {return filename;}
+    int64_t get_num_frames() const {return num_samples / channels;}
+
+    // count is in samples, with the channels interleaved
+    void write(const float* samples, int64_t count);
+    // Flushes the pending samples and updates the header sizes
+    bool sync();
+    void close();
+
+protected:
+    // samples are gathered in a buffer of this size before each write
+    static const int write_block_size = 1<<16;
+    // RIFF, a JUNK (or ds64) chunk, fmt and data chunk headers
+    static const int header_size = 80;
+
+    std::ofstream file;
+    std::string filename;
+    std::vector<float> pending;
+    int sample_rate = 0;
+    int channels = 1;
+    int64_t num_samples = 0;
+};
+
+#endif // PCM_FILE_H
@@ -0,0 +1,248 @@
+/*
+  Analyseur de MUsique et ENtraînement au CHAnt
+
+  This file is released under either of the two licenses below, your choice:
+  - LGPL v2.1 or later, https://www.gnu.org
+    The GNU Lesser General Public Licence, version 2.1 or,
+    at your option, any later version.
+  - CeCILL-C, http://www.cecill.info
+    The CeCILL-C license is more adapted to the French laws,
+    but can be converted to the GNU LGPL.
+
+  You can use, modify and/or redistribute the software under the terms of any
+  of these licences, which should have been provided to you together with this
+  sofware. If that is not the case, you can find a copy of the licences on
+  the indicated web sites.
+
+  By Nicolas . Brodu @ Inria . fr
+
+  See http://nicolas.brodu.net/programmation/amuencha/ for more information
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <new>
+#include <cstring>
+
+#include "recording_store.h"
+#include "audio_kernels.h"
+
+using namespace std;
+
+Recording_Store::Recording_Store()
+    : sample_blocks(new std::atomic<float*>[max_blocks]), runs(new Run[max_runs])
+{
+    for (int i=0; i<max_blocks; ++i) sample_blocks[i] = 0;
+    // the first blocks are ready before any recording starts
+    reserve_ahead();
+    maintainer = thread(&Recording_Store::maintain, this);
+}
+
+Recording_Store::~Recording_Store()
+{
+    {
+        lock_guard<mutex> lock(grow_mutex);
+        quit = true;
+    }
+    grow_condition.notify_all();
+    if (maintainer.joinable()) maintainer.join();
+    take.close();
+    for (int i=0; i<max_blocks; ++i) delete[] sample_blocks[i].load();
+}
+
+int64_t Recording_Store::append(int64_t song_position, const float* samples, int count, float gain)
+{
+    if (count<=0 || count>block_size) return -1;
+    const int64_t position = length.load(memory_order_relaxed);
+    // the samples may straddle two blocks
+    const int block = (int)(position / block_size);
+    const int offset = (int)(position % block_size);
+    const int first_count = min(count, block_size - offset);
+    float* data = block<max_blocks ? sample_blocks[block].load(memory_order_acquire) : 0;
+    float* next = 0;
+    if (first_count<count) next = block+1<max_blocks ? sample_blocks[block+1].load(memory_order_acquire) : 0;
+    // the grower did not keep up, drop the samples rather than allocate here
+    if (!data || (first_count<count && !next)) {
+        ++num_dropped;
+        return -1;
+    }
+    audio_kernels::apply_gain(samples, gain, data + offset, first_count);
+    if (next) audio_kernels::apply_gain(samples + first_count, gain, next, count - first_count);
+
+    // a new run unless the song simply went on, or stayed stopped
+    int n = num_runs.load(memory_order_relaxed);
+    bool new_run = (n==0);
+    if (n>0) {
+        const Run& last = runs[n-1];
+        int64_t expected = (last.song_position<0) ? -1 : last.song_position + position - last.position;
+        new_run = (song_position != expected);
+    }
+    if (new_run && n<max_runs) {
+        runs[n].position = position;
+        runs[n].song_position = song_position;
+        num_runs.store(n+1, memory_order_release);
+    }
+
+    // publishes the samples to the readers
+    length.store(position + count, memory_order_release);
+    return position;
+}
+
+int Recording_Store::span(int64_t position, int count, const float*& samples) const
+{
+    count = (int)min((int64_t)count, size() - position);
+    if (position<0 || count<=0) return 0;
+    const int block = (int)(position / block_size);
+    // The recording keeps the recent blocks, and the replay holds the
+    // releases, so a block still above the limit is not freed meanwhile
+    if (block<released_blocks.load(memory_order_acquire)) {
+        // same positions in the file, which is contiguous
+        if (!replay_samples || position + count > replay_num_frames) return 0;
+        samples = replay_samples + position;
+        return count;
+    }
+    const int offset = (int)(position % block_size);
+    samples = sample_blocks[block].load(memory_order_acquire) + offset;
+    return min(count, block_size - offset);
+}
+
+void Recording_Store::read(int64_t position, int count, float* out) const
+{
+    while (count>0) {
+        const float* samples;
+        int n = span(position, count, samples);
+        if (n<=0) break;
+        memcpy(out, samples, n*sizeof(float));
+        out += n;
+        position += n;
+        count -= n;
+    }
+    if (count>0) memset(out, 0, count*sizeof(float));
+}
+
+int64_t Recording_Store::song_position_at(int64_t position) const
+{
+    int n = num_runs.load(memory_order_acquire);
+    // the last run starting at or before the position
+    const Run* begin = runs.get();
+    const Run* end = begin + n;
+    const Run* run = upper_bound(begin, end, position, [](int64_t p, const Run& r) {return p < r.position;});
+    if (run==begin) return -1;
+    --run;
+    if (run->song_position<0) return -1;
+    return run->song_position + position - run->position;
+}
+
+void Recording_Store::clear()
+{
+    lock_guard<mutex> lock(grow_mutex);
+    // the samples not yet written still belong to the take
+    write_pending();
+    take.close();
+    replay_file = PCM_Reader();
+    replay_samples = 0;
+    replay_num_frames = 0;
+    written = 0;
+    released_blocks = 0;
+    replaying = false;
+    // release the memory of long takes, keep what reserve_ahead would allocate anyway
+    for (int i=spare_blocks+1; i<max_blocks; ++i) {
+        delete[] sample_blocks[i].load();
+        sample_blocks[i] = 0;
+    }
+    length = 0;
+    num_runs = 0;
+    num_dropped = 0;
+    reserve_ahead();
+}
+
+void Recording_Store::reserve_ahead()
+{
+    int block = (int)(length.load(memory_order_relaxed) / block_size);
+    for (int i=block; i<=block+spare_blocks && i<max_blocks; ++i) {
+        if (sample_blocks[i].load(memory_order_relaxed)) continue;
+        float* data = new (nothrow) float[block_size];
+        if (!data) return;
+        sample_blocks[i].store(data, memory_order_release);
+    }
+}
+
+bool Recording_Store::start_take(const std::string& filename, int sample_rate)
+{
+    lock_guard<mutex> lock(grow_mutex);
+    // the take file starts with the first sample
+    if (length!=0) return false;
+    return take.open(filename, sample_rate);
+}
+
+bool Recording_Store::prepare_replay()
+{
+    lock_guard<mutex> lock(grow_mutex);
+    replay_samples = 0;
+    replay_num_frames = 0;
+    if (!take.is_open()) {
+        replaying = true;
+        return true;
+    }
+    write_pending();
+    take.sync();
+    // a new mapping each time, the file grew since the last replay
+    if (!replay_file.open(take.get_filename()) || !replay_file.is_native_mono_float()) return false;
+    replay_samples = (const float*)(replay_file.get_mapping()->data() + replay_file.get_data_offset());
+    replay_num_frames = replay_file.get_num_frames();
+    replaying = true;
+    return true;
+}
+
+void Recording_Store::end_replay()
+{
+    lock_guard<mutex> lock(grow_mutex);
+    replaying = false;
+}
+
+void Recording_Store::write_pending()
+{
+    if (!take.is_open()) return;
+    const int64_t end = size();
+    while (written<end) {
+        // unwritten blocks are never released, the samples are in memory
+        const int block = (int)(written / block_size);
+        const int offset = (int)(written % block_size);
+        int n = (int)min((int64_t)(block_size - offset), end - written);
+        take.write(sample_blocks[block].load(memory_order_acquire) + offset, n);
+        written += n;
+    }
+}
+
+void Recording_Store::release_old()
+{
+    if (!take.is_open() || replaying) return;
+    // blocks with unwritten samples, or too recent, are kept
+    int limit = (int)min(written / block_size, size() / block_size - retention_blocks);
+    int released = released_blocks.load(memory_order_relaxed);
+    if (limit<=released) return;
+    released_blocks.store(limit, memory_order_release);
+    for (int i=released; i<limit; ++i) {
+        delete[] sample_blocks[i].load();
+        sample_blocks[i] = 0;
+    }
+}
+
+void Recording_Store::maintain_now()
+{
+    lock_guard<mutex> lock(grow_mutex);
+    reserve_ahead();
+    write_pending();
+    release_old();
+}
+
+void Recording_Store::maintain()
+{
+    unique_lock<mutex> lock(grow_mutex);
+    while (!quit) {
+        reserve_ahead();
+        write_pending();
+        release_old();
+        grow_condition.wait_for(lock, chrono::milliseconds(grow_period_ms));
+    }
+}
@@ -0,0 +1,152 @@
+/*
+  Analyseur de MUsique et ENtraînement au CHAnt
+
+  This file is released under either of the two licenses below, your choice:
+  - LGPL v2.1 or later, https://www.gnu.org
+    The GNU Lesser General Public Licence, version 2.1 or,
+    at your option, any later version.
+  - CeCILL-C, http://www.cecill.info
+    The CeCILL-C license is more adapted to the French laws,
+    but can be converted to the GNU LGPL.
+
+  You can use, modify and/or redistribute the software under the terms of any
+  of these licences, which should have been provided to you together with this
+  sofware. If that is not the case, you can find a copy of the licences on
+  the indicated web sites.
+
+  By Nicolas . Brodu @ Inria . fr
+
+  See http://nicolas.brodu.net/programmation/amuencha/ for more information
+*/
+
+#ifndef RECORDING_STORE_H
+#define RECORDING_STORE_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <string>
+#include <memory>
+
+#include "pcm_file.h"
+
+// Storage for the recorded input, filled from the audio callback without any
+// allocation. The take is a timeline indexed by sample position: sample p
+// lives in block p / block_size, at offset p % block_size, so any position
+// is reached in constant time, and the replay needs no per-take index.
+// Blocks are allocated ahead of the writer by a background thread, and never
+// move once allocated, so the stored samples can be given by pointer to the
+// analyzers and replayed in place.
+// The same background thread streams the take to a WAV file, then releases
+// the blocks that were written and are old enough, so only the last seconds
+// of a take stay in memory. Replay reads the older samples from the file,
+// where the sample positions are the same.
+// The song position is recorded as runs, a new run starting only when the
+// song was seeked, paused or resumed while recording.
+class Recording_Store
+{
+public:
+    Recording_Store();
+    ~Recording_Store();
+    Recording_Store(const Recording_Store&) = delete;
+    Recording_Store& operator=(const Recording_Store&) = delete;
+
+    // Called from the audio thread only. Appends the samples with the given
+    // gain, and returns the position of the first one, or -1 when no block
+    // was ready yet, in which case the samples are dropped
+    // song_position is -1 when the song is not playing
+    int64_t append(int64_t song_position, const float* samples, int count, float gain = 1.f);
+
+    // Number of samples in the take. Samples below size() can be read
+    // concurrently with append
+    int64_t size() const {return length.load(std::memory_order_acquire);}
+    bool empty() const {return size()==0;}
+    int64_t get_num_dropped() const {return num_dropped;}
+
+    // Sets samples to the stored position, and returns how many samples are
+    // contiguous from there, at most count, and 0 when not available
+    // The pointer remains valid until the next clear or prepare_replay, or
+    // for a recent position while recording, the retention_blocks period
+    // For an older position, only call between prepare_replay and end_replay
+    int span(int64_t position, int count, const float*& samples) const;
+    // Copies the samples from the blocks or the take file, zeros when not available
+    void read(int64_t position, int count, float* out) const;
+    // Song position at the time the sample was recorded, -1 when not playing
+    int64_t song_position_at(int64_t position) const;
+
+    // Forgets the take. Must not run concurrently with append
+    // The first blocks are kept for the next take, the others are released
+    // The take file is closed, and kept on disk
+    void clear();
+
+    // Streams the following samples to a new file. Without a take file,
+    // the whole recording stays in memory
+    bool start_take(const std::string& filename, int sample_rate);
+
+    // Writes the pending samples and maps the take file, so that the released
+    // blocks can be replayed. Call while not replaying
+    // Until end_replay, no block is released: the replay cursor, and the
+    // analyzers fed from it, may reach any of them
+    bool prepare_replay();
+    // Once nothing holds pointers from the replay any more
+    void end_replay();
+
+    // Runs the maintenance right away instead of waiting for the background
+    // thread, for drivers faster than real time
+    void maintain_now();
+
+protected:
+    // 1<<16 samples is about 1.4s at 48kHz
+    static const int block_size = 1<<16;
+    // address space for about 24h at 48kHz
+    static const int max_blocks = 1<<16;
+    // allocated in advance of the writer, about 5s of margin
+    static const int spare_blocks = 4;
+    static const int grow_period_ms = 50;
+    // kept in memory once written, for the analyzers and the recent replay
+    static const int retention_blocks = 4;
+    // seeks, play and pause while recording, beyond this the song position
+    // keeps following the last run
+    static const int max_runs = 1<<14;
+
+    struct Run {
+        // first sample of the run
+        int64_t position;
+        // song position at that sample, -1 when not playing
+        int64_t song_position;
+    };
+
+    void maintain();
+    void reserve_ahead();
+    void write_pending();
+    void release_old();
+
+    // on the heap, about 768KB that would not fit the stack of the owner
+    std::unique_ptr<std::atomic<float*>[]> sample_blocks;
+    std::unique_ptr<Run[]> runs;
+    std::atomic<int> num_runs {0};
+
+    // writer state, only modified by the audio thread (or clear)
+    std::atomic<int64_t> length {0};
+    std::atomic<int64_t> num_dropped {0};
+
+    // the maintenance thread allocates the blocks the writer will need,
+    // writes the take file and releases the old blocks
+    std::mutex grow_mutex;
+    std::condition_variable grow_condition;
+    bool quit = false;
+    std::thread maintainer;
+    WAV_Writer take;
+    int64_t written = 0;
+    // all blocks below are released
+    std::atomic<int> released_blocks {0};
+    // between prepare_replay and end_replay, under grow_mutex
+    bool replaying = false;
+    PCM_Reader replay_file;
+    const float* replay_samples = 0;
+    int64_t replay_num_frames = 0;
+};
+
+#endif // RECORDING_STORE_H
@@ -0,0 +1,287 @@
+/*
+  Analyseur de MUsique et ENtraînement au CHAnt
+
+  This file is released under either of the two licenses below, your choice:
+  - LGPL v2.1 or later, https://www.gnu.org
+    The GNU Lesser General Public Licence, version 2.1 or,
+    at your option, any later version.
+  - CeCILL-C, http://www.cecill.info
+    The CeCILL-C license is more adapted to the French laws,
+    but can be converted to the GNU LGPL.
+
+  You can use, modify and/or redistribute the software under the terms of any
+  of these licences, which should have been provided to you together with this
+  sofware. If that is not the case, you can find a copy of the licences on
+  the indicated web sites.
+
+  By Nicolas . Brodu @ Inria . fr
+
+  See http://nicolas.brodu.net/programmation/amuencha/ for more information
+*/
+
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+#include <cstring>
+
+#include "song_analysis.h"
+
+using namespace std;
+
+namespace {
+const char analysis_magic[8] = {'A','M','U','A','N','A','0','1'};
+
+// Autocorrelation of the onset envelope, weighted towards usual tempos
+// to avoid picking half or double the perceived tempo
+void estimate_tempo(Song_Analysis& analysis)
+{
+    analysis.tempo = 0;
+    analysis.beats.clear();
+    const vector<float>& onsets = analysis.onsets;
+    const float fps = (float)analysis.sample_rate / analysis.onset_hop;
+    const int n = onsets.size();
+    // A few seconds at least are needed for a meaningful pulse
+    if (n < fps * 4) return;
+
+    const float mean = accumulate(onsets.begin(), onsets.end(), 0.f) / n;
+    vector<float> centered(n);
+    for (int i=0; i<n; ++i) centered[i] = onsets[i] - mean;
+
+    const float min_bpm = 40, max_bpm = 200, preferred_bpm = 120;
+    int min_lag = max(1, (int)(fps * 60 / max_bpm));
+    int max_lag = min(n/2, (int)ceil(fps * 60 / min_bpm));
+    if (max_lag<=min_lag+1) return;
+    vector<float> ac(max_lag+2, 0.f);
+    for (int lag=min_lag-1; lag<=max_lag+1; ++lag) {
+        double sum = 0;
+        for (int i=0; i+lag<n; ++i) sum += centered[i] * centered[i+lag];
+        ac[lag] = sum / (n - lag);
+    }
+    int best_lag = 0;
+    float best_score = 0;
+    for (int lag=min_lag; lag<=max_lag; ++lag) {
+        float octaves = log2(fps * 60 / lag / preferred_bpm);
+        float score = ac[lag] * exp(-0.5f * octaves * octaves);
+        if (score>best_score) {
+            best_score = score;
+            best_lag = lag;
+        }
+    }
+    if (best_lag==0) return;
+    // sub-hop precision with a parabola through the peak and its neighbours
+    float period = best_lag;
+    float denom = ac[best_lag-1] - 2*ac[best_lag] + ac[best_lag+1];
+    if (denom<0) period += 0.5f * (ac[best_lag-1] - ac[best_lag+1]) / denom;
+
+    // Phase: the shift for which the beats fall on the most energy, over the first 10 seconds
+    int phase_span = min(n, (int)(fps * 10));
+    int best_shift = 0;
+    float best_sum = -1;
+    for (int shift=0; shift<(int)ceil(period); ++shift) {
+        float sum = 0;
+        for (float t=shift; t<phase_span; t+=period) sum += onsets[(int)lrintf(t)<n ? (int)lrintf(t) : n-1];
+        if (sum>best_sum) {
+            best_sum = sum;
+            best_shift = shift;
+        }
+    }
+
+    // Then follow the beats, allowing each one to move around its expected
+    // position, so the tempo can drift along the song
+    vector<int> beats;
+    float beat = best_shift;
+    float local_period = period;
+    while (beat < n) {
+        beats.push_back((int)lrintf(beat));
+        float expected = beat + local_period;
+        int tolerance = max(1, (int)(local_period * 0.1f));
+        int center = (int)lrintf(expected);
+        int best = center;
+        float best_onset = mean;
+        for (int i=max(0,center-tolerance); i<=min(n-1,center+tolerance); ++i) {
+            if (onsets[i]>best_onset) {
+                best_onset = onsets[i];
+                best = i;
+            }
+        }
+        // no marked onset: keep the pulse going at the current tempo
+        float next = (best_onset>mean) ? best : expected;
+        local_period = 0.9f * local_period + 0.1f * (next - beat);
+        beat = next;
+    }
+    if (beats.size()<2) return;
+    // the mean tempo is that of the mean of the instantaneous periods
+    float mean_period = (float)(beats.back() - beats.front()) / (beats.size() - 1);
+    analysis.tempo = fps * 60 / mean_period;
+    analysis.beats.resize(beats.size());
+    for (size_t i=0; i<beats.size(); ++i) analysis.beats[i] = (int64_t)beats[i] * analysis.onset_hop;
+}
+
+template<typename T>
+void write_vector(std::ostream& os, const vector<T>& v) {
+    int64_t size = v.size();
+    os.write(reinterpret_cast<const char*>(&size), sizeof(size));
+    if (size) os.write(reinterpret_cast<const char*>(&v[0]), size*sizeof(T));
+}
+
+template<typename T>
+bool read_vector(std::istream& is, vector<T>& v) {
+    int64_t size = 0;
+    is.read(reinterpret_cast<char*>(&size), sizeof(size));
+    if (!is || size<0 || size>(1LL<<32)) return false;
+    v.resize(size);
+    if (size) is.read(reinterpret_cast<char*>(&v[0]), size*sizeof(T));
+    return (bool)is;
+}
+}
+
+int Song_Analysis::estimate_key() const
+{
+    // Krumhansl-Kessler key profiles, starting from the tonic
+    static const float major_profile[12] = {6.35f, 2.23f, 3.48f, 2.33f, 4.38f, 4.09f, 2.52f, 5.19f, 2.39f, 3.66f, 2.29f, 2.88f};
+    static const float minor_profile[12] = {6.33f, 2.68f, 3.52f, 5.38f, 2.60f, 3.53f, 2.54f, 4.75f, 3.98f, 2.69f, 3.34f, 3.17f};
+    array<float,12> mean_chroma;
+    mean_chroma.fill(0.f);
+    for (const auto& profile: chroma) for (int pc=0; pc<12; ++pc) mean_chroma[pc] += profile[pc];
+    float chroma_mean = accumulate(mean_chroma.begin(), mean_chroma.end(), 0.f) / 12;
+    if (!(chroma_mean>0)) return -1;
+    // the key whose profile correlates best with the song
+    int best_key = -1;
+    float best_correlation = 0;
+    for (int key=0; key<24; ++key) {
+        const float* profile = key<12 ? major_profile : minor_profile;
+        float profile_mean = accumulate(profile, profile+12, 0.f) / 12;
+        float sxy = 0, sxx = 0, syy = 0;
+        for (int pc=0; pc<12; ++pc) {
+            float x = mean_chroma[(pc + key) % 12] - chroma_mean;
+            float y = profile[pc] - profile_mean;
+            sxy += x*y;
+            sxx += x*x;
+            syy += y*y;
+        }
+        if (sxx<=0) return -1;
+        float correlation = sxy / sqrt(sxx * syy);
+        if (correlation>best_correlation) {
+            best_correlation = correlation;
+            best_key = key;
+        }
+    }
+    return best_key;
+}
+
+void Song_Analysis::clear()
+{
+    *this = Song_Analysis();
+}
+
+bool Song_Analysis::write_to(std::ostream& os) const
+{
+    os.write(analysis_magic, sizeof(analysis_magic));
+    os.write(reinterpret_cast<const char*>(&sample_rate), sizeof(sample_rate));
+    os.write(reinterpret_cast<const char*>(&onset_hop), sizeof(onset_hop));
+    os.write(reinterpret_cast<const char*>(&chroma_hop), sizeof(chroma_hop));
+    os.write(reinterpret_cast<const char*>(&tempo), sizeof(tempo));
+    write_vector(os, onsets);
+    write_vector(os, beats);
+    write_vector(os, chroma);
+    return (bool)os;
+}
+
+bool Song_Analysis::read_from(std::istream& is)
+{
+    char magic[sizeof(analysis_magic)];
+    is.read(magic, sizeof(magic));
+    if (!is || memcmp(magic, analysis_magic, sizeof(magic))) return false;
+    is.read(reinterpret_cast<char*>(&sample_rate), sizeof(sample_rate));
+    is.read(reinterpret_cast<char*>(&onset_hop), sizeof(onset_hop));
+    is.read(reinterpret_cast<char*>(&chroma_hop), sizeof(chroma_hop));
+    is.read(reinterpret_cast<char*>(&tempo), sizeof(tempo));
+    return read_vector(is, onsets) && read_vector(is, beats) && read_vector(is, chroma);
+}
+
+Onset_Detector::Onset_Detector(int sample_rate) : sample_rate(sample_rate)
+{
+    // 10ms resolution is enough for the beats
+    hop = max(1, sample_rate / 100);
+    previous_log_energy = log(1e-10f);
+}
+
+void Onset_Detector::process(const float* samples, int count)
+{
+    for (int i=0; i<count;) {
+        // energy is the signal squared in the time domain, no need for frequencies here
+        int n = min(count - i, hop - hop_filled);
+        float sum = 0;
+        for (int j=0; j<n; ++j) sum += samples[i+j] * samples[i+j];
+        hop_energy += sum;
+        hop_filled += n;
+        i += n;
+        if (hop_filled==hop) {
+            float log_energy = log(1e-10f + (float)(hop_energy / hop));
+            onsets.push_back(max(0.f, log_energy - previous_log_energy));
+            previous_log_energy = log_energy;
+            hop_energy = 0;
+            hop_filled = 0;
+        }
+    }
+}
+
+void Onset_Detector::finish(Song_Analysis& analysis)
+{
+    analysis.sample_rate = sample_rate;
+    analysis.onset_hop = hop;
+    analysis.onsets.swap(onsets);
+    estimate_tempo(analysis);
+}
+
+Chroma_Extractor::Chroma_Extractor(int sample_rate) : sample_rate(sample_rate)
+{
+    // 10 frames per second, with short windows: this is for finding the
+    // chords, not for the precise display
+    hop = max(1, sample_rate / 10);
+    const int min_midi_note = 36, max_midi_note = 95; // C2 to B6
+    vector<float> frequencies;
+    for (int note=min_midi_note; note<=max_midi_note; ++note) {
+        frequencies.push_back(440.f * exp2((note - 69) / 12.f));
+        pitch_classes.push_back(note % 12);
+    }
+    analyzer.setup(sample_rate, frequencies, Frequency_Analyzer::PowerHandler(), 10, 100);
+    window_size = analyzer.get_max_window_size();
+    // silence before the song start
+    history.assign(window_size, 0.f);
+    next_frame_end = hop;
+}
+
+void Chroma_Extractor::process(const float* samples, int count)
+{
+    history.insert(history.end(), samples, samples+count);
+    num_samples += count;
+    while (next_frame_end <= num_samples) {
+        const float* frame_end = &history[0] + history.size() - (num_samples - next_frame_end);
+        analyzer.compute_spectrum(frame_end, reassigned, power);
+        std::array<float,12> profile;
+        profile.fill(0.f);
+        for (size_t idx=0; idx<power.size(); ++idx) {
+            // the reassigned frequency tells better than the bin which note is present
+            int pc = pitch_classes[idx];
+            if (reassigned[idx]>0) {
+                int note = (int)lrintf(12 * log2(reassigned[idx] / 440.f)) + 69;
+                pc = ((note % 12) + 12) % 12;
+            }
+            profile[pc] += power[idx];
+        }
+        float max_power = *max_element(profile.begin(), profile.end());
+        if (max_power>0) for (auto& p: profile) p /= max_power;
+        chroma.push_back(profile);
+        next_frame_end += hop;
+    }
+    // only keep what the next frames may need
+    int64_t keep = window_size + hop;
+    if ((int64_t)history.size() > 2*keep) history.erase(history.begin(), history.end() - keep);
+}
+
+void Chroma_Extractor::finish(Song_Analysis& analysis)
+{
+    analysis.chroma_hop = hop;
+    analysis.chroma.swap(chroma);
+}
@@ -0,0 +1,106 @@
+/*
+  Analyseur de MUsique et ENtraînement au CHAnt
+
+  This file is released under either of the two licenses below, your choice:
+  - LGPL v2.1 or later, https://www.gnu.org
+    The GNU Lesser General Public Licence, version 2.1 or,
+    at your option, any later version.
+  - CeCILL-C, http://www.cecill.info
+    The CeCILL-C license is more adapted to the French laws,
+    but can be converted to the GNU LGPL.
+
+  You can use, modify and/or redistribute the software under the terms of any
+  of these licences, which should have been provided to you together with this
+  sofware. If that is not the case, you can find a copy of the licences on
+  the indicated web sites.
+
+  By Nicolas . Brodu @ Inria . fr
+
+  See http://nicolas.brodu.net/programmation/amuencha/ for more information
+*/
+
+#ifndef SONG_ANALYSIS_H
+#define SONG_ANALYSIS_H
+
+#include <vector>
+#include <array>
+#include <iostream>
+#include <cstdint>
+
+#include "frequency_analyzer.h"
+
+// What is computed on the whole song while it is loaded, see the TODO
+// list in mainwindow.cpp: the tempo and beats from the signal energy, and
+// the pitch classes present at each moment, for finding the chords later.
+struct Song_Analysis
+{
+    int sample_rate = 0;
+
+    // Onset strength: increase of the log energy, one value each onset_hop samples
+    int onset_hop = 0;
+    std::vector<float> onsets;
+
+    // Mean tempo in beats per minute, and positions of the beats in samples
+    // tempo is 0 and beats empty when no regular pulse could be found
+    float tempo = 0;
+    std::vector<int64_t> beats;
+
+    // Pitch class profile (C, C#, D... B), normalized so the max is 1,
+    // one each chroma_hop samples
+    int chroma_hop = 0;
+    std::vector<std::array<float,12>> chroma;
+
+    // Key of the whole song from the mean pitch class profile: the tonic
+    // pitch class for a major key, 12 + the tonic for a minor key, or -1
+    int estimate_key() const;
+
+    void clear();
+    bool write_to(std::ostream& os) const;
+    bool read_from(std::istream& is);
+};
+
+// Energy and onset extraction, then tempo and beat tracking at the end
+// Fed with consecutive blocks of the song, of any size
+class Onset_Detector
+{
+public:
+    explicit Onset_Detector(int sample_rate);
+    void process(const float* samples, int count);
+    // Also estimates the tempo and the beats from all the onsets
+    void finish(Song_Analysis& analysis);
+
+protected:
+    int sample_rate;
+    int hop;
+    int hop_filled = 0;
+    double hop_energy = 0;
+    float previous_log_energy;
+    std::vector<float> onsets;
+};
+
+// Pitch classes, using the same filter bank as the live display at a
+// coarser resolution (one bin per semitone) and a lower rate
+// Fed with consecutive blocks of the song, of any size
+class Chroma_Extractor
+{
+public:
+    explicit Chroma_Extractor(int sample_rate);
+    void process(const float* samples, int count);
+    void finish(Song_Analysis& analysis);
+
+protected:
+    // Used synchronously, its thread is never started
+    Frequency_Analyzer analyzer;
+    int sample_rate;
+    int hop;
+    int window_size;
+    std::vector<int> pitch_classes;
+    // Last samples of the song, enough for the largest analysis window
+    std::vector<float> history;
+    int64_t num_samples = 0;
+    int64_t next_frame_end;
+    std::vector<float> reassigned, power;
+    std::vector<std::array<float,12>> chroma;
+};
+
+#endif // SONG_ANALYSIS_H
@@ -0,0 +1,198 @@
+/*
+  Analyseur de MUsique et ENtraînement au CHAnt
+
+  This file is released under either of the two licenses below, your choice:
+  - LGPL v2.1 or later, https://www.gnu.org
+    The GNU Lesser General Public Licence, version 2.1 or,
+    at your option, any later version.
+  - CeCILL-C, http://www.cecill.info
+    The CeCILL-C license is more adapted to the French laws,
+    but can be converted to the GNU LGPL.
+
+  You can use, modify and/or redistribute the software under the terms of any
+  of these licences, which should have been provided to you together with this
+  sofware. If that is not the case, you can find a copy of the licences on
+  the indicated web sites.
+
+  By Nicolas . Brodu @ Inria . fr
+
+  See http://nicolas.brodu.net/programmation/amuencha/ for more information
+*/
+
+#include <utility>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "song_buffer.h"
+
+using namespace std;
+
+namespace {
+typedef float v8sf __attribute__ ((vector_size (32)));
+typedef int16_t v8hi __attribute__ ((vector_size (16)));
+typedef int32_t v8si __attribute__ ((vector_size (32)));
+
+int64_t num_blocks(int64_t count) {
+    return (count + Song_Buffer::block_size - 1) / Song_Buffer::block_size;
+}
+
+// Block floating point: the largest sample of the block sets the scale
+// dst holds block_size mantissas, those past n are left as is
+float convert_block(const float* src, int n, int16_t* dst) {
+    float maxabs = 0;
+    for (int i=0; i<n; ++i) maxabs = max(maxabs, fabsf(src[i]));
+    float scale = maxabs / 32767.f;
+    if (scale==0) return scale;
+    float inv_scale = 1.f / scale;
+    for (int i=0; i<n; ++i) dst[i] = (int16_t)lrintf(src[i] * inv_scale);
+    return scale;
+}
+}
+
+void Song_Buffer::start_appending(Format format, int64_t capacity)
+{
+    clear();
+    this->format = format;
+    if (format==FLOAT32) heap.reserve(capacity);
+    else {
+        heap_scales.reserve(num_blocks(capacity));
+        heap_mantissas.reserve(num_blocks(capacity) * block_size);
+        pending.reserve(block_size);
+    }
+}
+
+void Song_Buffer::append(const float* samples, int64_t count)
+{
+    if (format==FLOAT32) {
+        heap.insert(heap.end(), samples, samples+count);
+        num_samples = heap.size();
+        this->samples = heap.empty() ? 0 : &heap[0];
+        return;
+    }
+    while (count>0) {
+        int n = (int)min((int64_t)block_size - (int64_t)pending.size(), count);
+        pending.insert(pending.end(), samples, samples+n);
+        samples += n;
+        count -= n;
+        if ((int)pending.size()==block_size) convert_pending();
+    }
+}
+
+void Song_Buffer::finish_appending()
+{
+    if (format!=FLOAT32) convert_pending();
+    vector<float>().swap(pending);
+}
+
+void Song_Buffer::convert_pending()
+{
+    if (pending.empty()) return;
+    heap_mantissas.resize(heap_mantissas.size() + block_size, 0);
+    heap_scales.push_back(convert_block(&pending[0], pending.size(), &heap_mantissas[heap_mantissas.size() - block_size]));
+    num_samples += pending.size();
+    pending.clear();
+    // the vectors may have moved
+    scales = &heap_scales[0];
+    mantissas = &heap_mantissas[0];
+}
+
+bool Song_Buffer::assign(const std::shared_ptr<Mapped_File>& file, size_t offset, int64_t count, Format format)
+{
+    clear();
+    if (!file || !file->is_open()) return false;
+    if (offset + storage_size(count, format) > file->size()) return false;
+    // floats must be aligned in the mapping, which itself is page-aligned
+    if (offset % sizeof(float)) return false;
+    mapping = file;
+    mapping_offset = offset;
+    this->format = format;
+    if (format==FLOAT32) samples = reinterpret_cast<const float*>(file->data() + offset);
+    else {
+        scales = reinterpret_cast<const float*>(file->data() + offset);
+        mantissas = reinterpret_cast<const int16_t*>(file->data() + offset + num_blocks(count)*sizeof(float));
+    }
+    num_samples = count;
+    return true;
+}
+
+void Song_Buffer::swap(Song_Buffer& other)
+{
+    // vector swap keeps the element addresses, so the pointers remain valid
+    std::swap(format, other.format);
+    heap.swap(other.heap);
+    heap_scales.swap(other.heap_scales);
+    heap_mantissas.swap(other.heap_mantissas);
+    pending.swap(other.pending);
+    mapping.swap(other.mapping);
+    std::swap(mapping_offset, other.mapping_offset);
+    std::swap(samples, other.samples);
+    std::swap(scales, other.scales);
+    std::swap(mantissas, other.mantissas);
+    std::swap(num_samples, other.num_samples);
+}
+
+void Song_Buffer::clear()
+{
+    format = FLOAT32;
+    vector<float>().swap(heap);
+    vector<float>().swap(heap_scales);
+    vector<int16_t>().swap(heap_mantissas);
+    vector<float>().swap(pending);
+    mapping.reset();
+    mapping_offset = 0;
+    samples = 0;
+    scales = 0;
+    mantissas = 0;
+    num_samples = 0;
+}
+
+const float* Song_Buffer::read(int64_t position, int count, float* scratch) const
+{
+    if (format==FLOAT32) return samples + position;
+
+    // 8 samples at a time, a vector never straddles two blocks as the block size is a multiple of 8
+    int i = 0;
+    while (i<count) {
+        int64_t p = position + i;
+        const float scale = scales[p / block_size];
+        if ((p & 7)==0 && i+8<=count) {
+            v8hi m;
+            memcpy(&m, &mantissas[p], sizeof(m));
+            v8sf f = __builtin_convertvector(__builtin_convertvector(m, v8si), v8sf) * scale;
+            memcpy(&scratch[i], &f, sizeof(f));
+            i += 8;
+            continue;
+        }
+        scratch[i] = mantissas[p] * scale;
+        ++i;
+    }
+    return scratch;
+}
+
+size_t Song_Buffer::storage_size(int64_t count, Format format)
+{
+    if (format==FLOAT32) return count * sizeof(float);
+    return num_blocks(count) * (sizeof(float) + block_size * sizeof(int16_t));
+}
+
+bool Song_Buffer::write_to(std::ostream& os) const
+{
+    if (format==FLOAT32) os.write(reinterpret_cast<const char*>(samples), num_samples*sizeof(float));
+    else {
+        int64_t nblocks = num_blocks(num_samples);
+        os.write(reinterpret_cast<const char*>(scales), nblocks*sizeof(float));
+        os.write(reinterpret_cast<const char*>(mantissas), nblocks*block_size*sizeof(int16_t));
+    }
+    return (bool)os;
+}
+
+void Song_Buffer::prefetch(int64_t position, int64_t count) const
+{
+    if (!mapping) return;
+    if (format==FLOAT32) mapping->prefetch(mapping_offset + position*sizeof(float), count*sizeof(float));
+    else {
+        size_t mantissas_offset = mapping_offset + num_blocks(num_samples)*sizeof(float);
+        mapping->prefetch(mantissas_offset + position*sizeof(int16_t), count*sizeof(int16_t));
+    }
+}
@@ -0,0 +1,99 @@
+/*
+  Analyseur de MUsique et ENtraînement au CHAnt
+
+  This file is released under either of the two licenses below, your choice:
+  - LGPL v2.1 or later, https://www.gnu.org
+    The GNU Lesser General Public Licence, version 2.1 or,
+    at your option, any later version.
+  - CeCILL-C, http://www.cecill.info
+    The CeCILL-C license is more adapted to the French laws,
+    but can be converted to the GNU LGPL.
+
+  You can use, modify and/or redistribute the software under the terms of any
+  of these licences, which should have been provided to you together with this
+  sofware. If that is not the case, you can find a copy of the licences on
+  the indicated web sites.
+
+  By Nicolas . Brodu @ Inria . fr
+
+  See http://nicolas.brodu.net/programmation/amuencha/ for more information
+*/
+
+#ifndef SONG_BUFFER_H
+#define SONG_BUFFER_H
+
+#include <vector>
+#include <memory>
+#include <ostream>
+#include <cstdint>
+
+#include "mapped_file.h"
+
+// The decoded song, mono samples at the device rate.
+// Samples are either owned on the heap, or read directly from a mapped
+// file (e.g. the decoded PCM cache), in which case the OS pages them in
+// only when they are played.
+// The storage is either plain floats, or a compact block-floating-point
+// format: one float scale per block of samples, and 16-bit mantissas.
+// This halves the memory, and keeps about 90dB of dynamic range within
+// each block, which is plenty for playing along and for the analysis.
+class Song_Buffer
+{
+public:
+    enum Format {FLOAT32 = 0, BLOCK_FLOAT16 = 1};
+    // number of samples sharing the same scale in the compact format
+    static const int block_size = 256;
+
+    Song_Buffer() {}
+
+    // Uses count samples stored at the given byte offset of the mapped file, without copy
+    // The data layout is that written by write_to
+    bool assign(const std::shared_ptr<Mapped_File>& file, size_t offset, int64_t count, Format format);
+
+    // Builds the song piece by piece, in order. The compact format converts
+    // each block as soon as it is complete, so the song is never held in
+    // full as floats. capacity is a hint, in samples
+    void start_appending(Format format, int64_t capacity = 0);
+    void append(const float* samples, int64_t count);
+    // converts the last partial block
+    void finish_appending();
+
+    void swap(Song_Buffer& other);
+    void clear();
+
+    int64_t size() const {return num_samples;}
+    bool empty() const {return num_samples==0;}
+    Format get_format() const {return format;}
+
+    // Direct access to the samples, only for the FLOAT32 format, 0 otherwise
+    const float* data() const {return samples;}
+
+    // Returns count samples starting at position, converted to float if needed.
+    // The result points into the storage for FLOAT32 songs, and into scratch
+    // otherwise, which must then hold at least count floats.
+    const float* read(int64_t position, int count, float* scratch) const;
+
+    // Storage layout, for caching the song on disk and mapping it back
+    static size_t storage_size(int64_t count, Format format);
+    bool write_to(std::ostream& os) const;
+
+    // Hint that the samples starting at position will be needed soon
+    void prefetch(int64_t position, int64_t count) const;
+
+protected:
+    Format format = FLOAT32;
+    std::vector<float> heap;
+    std::vector<float> heap_scales;
+    std::vector<int16_t> heap_mantissas;
+    // samples appended since the last complete block, compact format only
+    std::vector<float> pending;
+    void convert_pending();
+    std::shared_ptr<Mapped_File> mapping;
+    size_t mapping_offset = 0;
+    const float* samples = 0;
+    const float* scales = 0;
+    const int16_t* mantissas = 0;
+    int64_t num_samples = 0;
+};
+
+#endif // SONG_BUFFER_H
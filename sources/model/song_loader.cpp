@@ -0,0 +1,641 @@
+/*
+  Analyseur de MUsique et ENtraînement au CHAnt
+
+  This file is released under either of the two licenses below, your choice:
+  - LGPL v2.1 or later, https://www.gnu.org
+    The GNU Lesser General Public Licence, version 2.1 or,
+    at your option, any later version.
+  - CeCILL-C, http://www.cecill.info
+    The CeCILL-C license is more adapted to the French laws,
+    but can be converted to the GNU LGPL.
+
+  You can use, modify and/or redistribute the software under the terms of any
+  of these licences, which should have been provided to you together with this
+  sofware. If that is not the case, you can find a copy of the licences on
+  the indicated web sites.
+
+  By Nicolas . Brodu @ Inria . fr
+
+  See http://nicolas.brodu.net/programmation/amuencha/ for more information
+*/
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libavutil/opt.h>
+#include <libswresample/swresample.h>
+}
+
+#include "song_loader.h"
+
+using namespace std;
+
+namespace {
+
+// Decoded PCM cache file layout: this header, then the float samples
+// The header size keeps the samples aligned in the mapping
+struct Cache_Header {
+    char magic[8];
+    uint64_t source_hash;
+    int32_t sample_rate;
+    int32_t format;
+    int64_t num_samples;
+    char padding[32];
+};
+static_assert(sizeof(Cache_Header)==64, "Unexpected padding in the cache header");
+const char cache_magic[8] = {'A','M','U','P','C','M','0','1'};
+
+// One full decoding chain. Each segment has its own, so they can run in parallel
+struct Decoder {
+    AVFormatContext *fmt_ctx = 0;
+    AVCodecContext *dec_ctx = 0;
+    SwrContext *swr = 0;
+    AVFrame *frame = 0;
+    AVStream *stream = 0;
+    int stream_index = -1;
+
+    ~Decoder() {
+        if (swr) swr_free(&swr);
+        if (frame) av_frame_free(&frame);
+        if (dec_ctx) avcodec_free_context(&dec_ctx);
+        if (fmt_ctx) avformat_close_input(&fmt_ctx);
+    }
+
+    // num_threads = 0 lets libav decide, use 1 when the segments already occupy all cores
+    Song_Loader::Status open(const string& filename, int sample_rate, int num_threads) {
+        AVCodec *dec = 0;
+        if (avformat_open_input(&fmt_ctx, filename.c_str(), 0, 0)<0) {
+            fmt_ctx = 0;
+            return Song_Loader::CANNOT_OPEN;
+        }
+        if (avformat_find_stream_info(fmt_ctx, NULL) < 0) return Song_Loader::NO_STREAM_INFO;
+        stream_index = av_find_best_stream(fmt_ctx, AVMEDIA_TYPE_AUDIO, -1, -1, &dec, 0);
+        if (stream_index < 0) return Song_Loader::NO_AUDIO_STREAM;
+        stream = fmt_ctx->streams[stream_index];
+        dec_ctx = avcodec_alloc_context3(dec);
+        if (!dec_ctx) return Song_Loader::NO_MEMORY;
+        avcodec_parameters_to_context(dec_ctx, stream->codecpar);
+        av_opt_set_int(dec_ctx, "refcounted_frames", 1, 0);
+        dec_ctx->thread_count = num_threads;
+        if (avcodec_open2(dec_ctx, dec, NULL) < 0) return Song_Loader::UNKNOWN_FORMAT;
+        frame = av_frame_alloc();
+        if (!frame) return Song_Loader::NO_MEMORY;
+
+        // Some decoders do not fill the layout, deduce it from the number of channels
+        int64_t layout = dec_ctx->channel_layout;
+        if (!layout) layout = av_get_default_channel_layout(dec_ctx->channels);
+        swr = swr_alloc();
+        if (!swr) return Song_Loader::NO_MEMORY;
+        av_opt_set_int(swr, "in_channel_layout",  layout, 0);
+        av_opt_set_int(swr, "out_channel_layout", AV_CH_LAYOUT_MONO ,  0);
+        av_opt_set_int(swr, "in_sample_rate",     dec_ctx->sample_rate, 0);
+        av_opt_set_int(swr, "out_sample_rate",    sample_rate, 0);
+        av_opt_set_sample_fmt(swr, "in_sample_fmt",  dec_ctx->sample_fmt, 0);
+        av_opt_set_sample_fmt(swr, "out_sample_fmt", AV_SAMPLE_FMT_FLTP,  0);
+        if (swr_init(swr)<0) return Song_Loader::UNKNOWN_FORMAT;
+        return Song_Loader::OK;
+    }
+
+    // Resample the current frame, or flush the resampler when frame is null
+    void convert(AVFrame* frame, vector<float>& samples) {
+        int nb_in = frame ? frame->nb_samples : 0;
+        int max_out = swr_get_out_samples(swr, nb_in);
+        if (max_out<=0) return;
+        int cur_size = samples.size();
+        samples.resize(cur_size+max_out);
+        uint8_t* outbuf = reinterpret_cast<uint8_t*>(&samples[cur_size]);
+        int num_out = swr_convert(swr, &outbuf, max_out,
+                                  frame ? const_cast<const uint8_t**>(frame->extended_data) : 0, nb_in);
+        samples.resize(cur_size+max(0,num_out));
+    }
+};
+
+}
+
+Song_Loader::Song_Loader()
+{
+}
+
+Song_Loader::~Song_Loader()
+{
+    abort();
+    if (master.joinable()) master.join();
+}
+
+Song_Loader::Status Song_Loader::start(const std::string& filename, int sample_rate, Song_Buffer::Format format)
+{
+    this->filename = filename;
+    this->sample_rate = sample_rate;
+    this->format = format;
+    finished = false;
+    aborted = false;
+    num_decoded_samples = 0;
+    num_onset_samples = 0;
+    num_chroma_samples = 0;
+
+    // Fast path for uncompressed files
+    use_pcm = pcm.open(filename);
+    if (use_pcm) {
+        estimated_num_samples = pcm.get_num_frames() * sample_rate / pcm.get_sample_rate();
+        num_segments = 1;
+        master = thread(&Song_Loader::run, this);
+        return OK;
+    }
+
+    // Open once for checking the file and deciding how to split it
+    Decoder probe;
+    Status probe_status = probe.open(filename, sample_rate, 0);
+    if (probe_status!=OK) return probe_status;
+
+    float duration = 0;
+    if (probe.fmt_ctx->duration!=AV_NOPTS_VALUE) {
+        duration = (float)probe.fmt_ctx->duration / AV_TIME_BASE;
+        estimated_num_samples = (int64_t)sample_rate * probe.fmt_ctx->duration / AV_TIME_BASE;
+    }
+
+    // Parallel decoding needs reliable seeking, hence a seekable input with a known duration
+    num_segments = 1;
+    bool seekable = probe.fmt_ctx->pb && (probe.fmt_ctx->pb->seekable & AVIO_SEEKABLE_NORMAL);
+    if (seekable && duration>0) {
+        int ncores = max(1u, thread::hardware_concurrency());
+        num_segments = max(1, min(ncores, (int)(duration / min_segment_duration)));
+    }
+
+    master = thread(&Song_Loader::run, this);
+    return OK;
+}
+
+void Song_Loader::run()
+{
+    // The analysis stages run concurrently with the decoding, each on its own
+    // core, and are fed with the song in order as soon as it is available
+    num_streamed = 0;
+    onset_queue.reopen();
+    chroma_queue.reopen();
+    analysis.clear();
+    thread onset_thread(&Song_Loader::run_onsets, this);
+    thread chroma_thread(&Song_Loader::run_chroma, this);
+
+    bool analysis_cached = false;
+    if (use_pcm) load_pcm();
+    else {
+        // the hash names the cache files, hashing would only read the file twice without them
+        if (!cache_directory.empty()) source_hash = hash_file(filename, aborted);
+        if (read_from_cache()) {
+            analysis_cached = ifstream(analysis_cache_filename(), ios::binary).good();
+            if (!analysis_cached) stream_song(song_result);
+        }
+        else {
+            decode_segments();
+            stitch();
+            if (!aborted && status==OK) write_to_cache();
+        }
+    }
+
+    // The stages finish processing what they were given
+    onset_queue.close();
+    chroma_queue.close();
+    onset_thread.join();
+    chroma_thread.join();
+    // An abort may happen after the song itself was loaded, while streaming it
+    // to the analysis: the partial analysis must be neither used nor cached
+    if (aborted) status = ABORTED;
+    else if (!use_pcm) {
+        if (analysis_cached) read_analysis();
+        else if (status==OK) write_analysis();
+    }
+    finished = true;
+}
+
+void Song_Loader::decode_segments()
+{
+    vector<Segment> parallel(num_segments);
+    segments.swap(parallel);
+    for (int i=0; i<num_segments; ++i) {
+        segments[i].start = estimated_num_samples * i / num_segments;
+        segments[i].end = (i==num_segments-1) ? -1 : estimated_num_samples * (i+1) / num_segments;
+    }
+    if (num_segments==1) decode_segment(segments[0], 0, true);
+    else {
+        for (int i=0; i<num_segments; ++i) segments[i].thread = thread(&Song_Loader::decode_segment, this, ref(segments[i]), 1, i==0);
+        for (auto& seg: segments) seg.thread.join();
+
+        // Some demuxers do not land where asked, or give no timestamps.
+        // Then the segments cannot be stitched, fall back to a single decoder
+        bool misplaced = false;
+        for (const auto& seg: segments) misplaced |= seg.misplaced;
+        if (misplaced && !aborted) {
+            vector<Segment> sequential(1);
+            segments.swap(sequential);
+            num_decoded_samples = 0;
+            decode_segment(segments[0], 0, true);
+        }
+    }
+}
+
+void Song_Loader::decode_segment(Segment& seg, int num_threads, bool streamed)
+{
+    Decoder d;
+    seg.status = d.open(filename, sample_rate, num_threads);
+    if (seg.status!=OK) return;
+
+    const int64_t stream_start = (d.stream->start_time==AV_NOPTS_VALUE) ? 0 : d.stream->start_time;
+    const AVRational out_time_base = {1, sample_rate};
+    if (seg.start>0) {
+        int64_t target = max((int64_t)0, seg.start - (int64_t)(preroll_duration * sample_rate));
+        int64_t ts = stream_start + av_rescale_q(target, out_time_base, d.stream->time_base);
+        if (av_seek_frame(d.fmt_ctx, d.stream_index, ts, AVSEEK_FLAG_BACKWARD)<0) {
+            seg.misplaced = true;
+            return;
+        }
+    }
+    // reserve with little extra half-second for the approximation
+    if (seg.end>0) seg.samples.reserve(seg.end - seg.start + (int64_t)(sample_rate*preroll_duration*2));
+    else seg.samples.reserve(max((int64_t)0, estimated_num_samples - seg.start) + (int64_t)(sample_rate*preroll_duration*2));
+
+    int64_t progress = 0;
+    // Resampling stage, for one decoded frame or for flushing when frame is null
+    // Returns true once the end of the segment is reached
+    auto resample = [&](AVFrame* frame) {
+        d.convert(frame, seg.samples);
+        int64_t reached = seg.first_sample + (int64_t)seg.samples.size();
+        int64_t new_progress = max((int64_t)0, reached - max(seg.start, seg.first_sample));
+        num_decoded_samples += new_progress - progress;
+        progress = new_progress;
+        // The first segment feeds the analysis as it goes, the others wait for the stitching
+        if (streamed) {
+            int64_t available = seg.samples.size();
+            if (seg.end>=0) available = min(available, seg.end - seg.first_sample);
+            if (available>num_streamed) stream_out(&seg.samples[num_streamed], available - num_streamed);
+        }
+        return seg.end>=0 && reached>=seg.end;
+    };
+
+    // With a single decoder, resampling runs on its own core. The decoded
+    // frames are handed over through a bounded queue
+    const bool pipelined = (num_threads==0);
+    Bounded_Queue<AVFrame*> frames(32);
+    thread resampler;
+    if (pipelined) resampler = thread([&]() {
+        AVFrame* frame;
+        while (frames.pop(frame)) {
+            resample(frame);
+            if (frame) av_frame_free(&frame);
+        }
+    });
+
+    bool placed = false;
+    // Returns true when the segment is complete, or cannot be completed
+    auto receive_frames = [&]() {
+        while (true) {
+            int ret = avcodec_receive_frame(d.dec_ctx, d.frame);
+            if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) return false;
+            if (ret < 0) {
+                seg.status = DECODE_ERROR;
+                return true;
+            }
+            if (!placed) {
+                // All samples after the first frame are contiguous, only the first one needs a timestamp
+                int64_t pts = d.frame->best_effort_timestamp;
+                if (pts==AV_NOPTS_VALUE) pts = stream_start;
+                seg.first_sample = av_rescale_q(pts - stream_start, d.stream->time_base, out_time_base);
+                // The decoder must start before the segment for the stitching to be seamless
+                if (seg.start>0 && (d.frame->best_effort_timestamp==AV_NOPTS_VALUE || seg.first_sample>seg.start)) {
+                    seg.misplaced = true;
+                    av_frame_unref(d.frame);
+                    return true;
+                }
+                placed = true;
+            }
+            if (pipelined) {
+                AVFrame* decoded = av_frame_alloc();
+                if (!decoded) {
+                    seg.status = NO_MEMORY;
+                    return true;
+                }
+                av_frame_move_ref(decoded, d.frame);
+                if (!frames.push(decoded)) av_frame_free(&decoded);
+                continue;
+            }
+            bool done = resample(d.frame);
+            av_frame_unref(d.frame);
+            if (done) return true;
+        }
+    };
+
+    AVPacket packet;
+    bool done = false;
+    while (!done && !aborted) {
+        if (av_read_frame(d.fmt_ctx, &packet)<0) {
+            // drain the frames still held by the decoder, then the resampler
+            avcodec_send_packet(d.dec_ctx, NULL);
+            if (!receive_frames() && !seg.misplaced) {
+                if (pipelined) frames.push(0);
+                else resample(0);
+            }
+            break;
+        }
+        if (packet.stream_index!=d.stream_index) {
+            av_packet_unref(&packet);
+            continue;
+        }
+        if (avcodec_send_packet(d.dec_ctx, &packet)<0) {
+            av_packet_unref(&packet);
+            seg.status = DECODE_ERROR;
+            break;
+        }
+        av_packet_unref(&packet);
+        done = receive_frames();
+    }
+
+    if (pipelined) {
+        frames.close();
+        resampler.join();
+    }
+}
+
+void Song_Loader::stream_out(const float* samples, int64_t count)
+{
+    num_streamed += count;
+    if (aborted) return;
+    for (int64_t i=0; i<count; i+=analysis_block_size) {
+        int n = (int)min((int64_t)analysis_block_size, count-i);
+        shared_ptr<const vector<float>> block = make_shared<vector<float>>(samples+i, samples+i+n);
+        onset_queue.push(block);
+        chroma_queue.push(block);
+    }
+}
+
+void Song_Loader::stream_song(const Song_Buffer& song)
+{
+    vector<float> scratch(analysis_block_size);
+    for (int64_t pos=0; pos<song.size() && !aborted; pos+=analysis_block_size) {
+        int n = (int)min((int64_t)analysis_block_size, song.size()-pos);
+        stream_out(song.read(pos, n, &scratch[0]), n);
+    }
+}
+
+void Song_Loader::run_onsets()
+{
+    Onset_Detector detector(sample_rate);
+    shared_ptr<const vector<float>> block;
+    while (onset_queue.pop(block)) {
+        if (!aborted) detector.process(&(*block)[0], block->size());
+        num_onset_samples += block->size();
+    }
+    detector.finish(analysis);
+}
+
+void Song_Loader::run_chroma()
+{
+    Chroma_Extractor extractor(sample_rate);
+    shared_ptr<const vector<float>> block;
+    while (chroma_queue.pop(block)) {
+        if (!aborted) extractor.process(&(*block)[0], block->size());
+        num_chroma_samples += block->size();
+    }
+    extractor.finish(analysis);
+}
+
+void Song_Loader::load_pcm()
+{
+    const int64_t num_frames = pcm.get_num_frames();
+    // Nothing to convert: the file samples are the song
+    if (pcm.get_sample_rate()==sample_rate && pcm.is_native_mono_float() && format==Song_Buffer::FLOAT32) {
+        song_result.assign(pcm.get_mapping(), pcm.get_data_offset(), num_frames, Song_Buffer::FLOAT32);
+        num_decoded_samples = num_frames;
+        status = OK;
+        stream_song(song_result);
+        return;
+    }
+
+    SwrContext *swr = 0;
+    if (pcm.get_sample_rate()!=sample_rate) {
+        swr = swr_alloc();
+        av_opt_set_int(swr, "in_channel_layout",  AV_CH_LAYOUT_MONO, 0);
+        av_opt_set_int(swr, "out_channel_layout", AV_CH_LAYOUT_MONO ,  0);
+        av_opt_set_int(swr, "in_sample_rate",     pcm.get_sample_rate(), 0);
+        av_opt_set_int(swr, "out_sample_rate",    sample_rate, 0);
+        av_opt_set_sample_fmt(swr, "in_sample_fmt",  AV_SAMPLE_FMT_FLT, 0);
+        av_opt_set_sample_fmt(swr, "out_sample_fmt", AV_SAMPLE_FMT_FLT,  0);
+        if (!swr || swr_init(swr)<0) {
+            if (swr) swr_free(&swr);
+            status = UNKNOWN_FORMAT;
+            return;
+        }
+    }
+    // The converted samples go into the song block by block, the compact
+    // format never holds the whole song as floats
+    const int block_size = 1<<16;
+    vector<float> mono(block_size);
+    vector<float> converted;
+    song_result.start_appending(format, estimated_num_samples + sample_rate);
+    auto emit = [&](const float* samples, int count) {
+        if (count<=0) return;
+        song_result.append(samples, count);
+        num_decoded_samples += count;
+        stream_out(samples, count);
+    };
+    auto resample = [&](const float* mono, int count) {
+        int max_out = swr_get_out_samples(swr, count);
+        if (max_out<=0) return;
+        converted.resize(max_out);
+        uint8_t* outbuf = reinterpret_cast<uint8_t*>(&converted[0]);
+        const uint8_t* inbuf = reinterpret_cast<const uint8_t*>(mono);
+        int num_out = swr_convert(swr, &outbuf, max_out, mono ? &inbuf : 0, count);
+        emit(&converted[0], num_out);
+    };
+    for (int64_t first = 0; first<num_frames && !aborted; first += block_size) {
+        int count = (int)min((int64_t)block_size, num_frames - first);
+        pcm.read_mono(first, count, &mono[0]);
+        if (swr) resample(&mono[0], count);
+        else emit(&mono[0], count);
+    }
+    if (swr) {
+        // flush the last few samples kept by the resampler
+        if (!aborted) resample(0, 0);
+        swr_free(&swr);
+    }
+    if (aborted) {
+        song_result.clear();
+        status = ABORTED;
+        return;
+    }
+    song_result.finish_appending();
+    status = OK;
+}
+
+void Song_Loader::stitch()
+{
+    if (aborted) {
+        status = ABORTED;
+        return;
+    }
+    status = OK;
+    // The first segment is kept as is, its first sample defines the song start
+    const int64_t origin = segments[0].first_sample;
+    int64_t total = 0;
+    for (const auto& seg: segments) total += seg.samples.size();
+    // Each segment goes into the song as soon as it is stitched, then its
+    // floats are freed, so the compact format never holds the whole song twice
+    song_result.start_appending(format, total);
+    int64_t stitched = 0;
+    for (auto& seg: segments) {
+        if (seg.status!=OK) {
+            status = seg.status;
+            break;
+        }
+        // Trim the pre-roll of this segment, and whatever overlaps the next one
+        int64_t from = max((int64_t)0, origin + stitched - seg.first_sample);
+        int64_t to = seg.samples.size();
+        if (seg.end>=0) to = min(to, seg.end - seg.first_sample);
+        if (from<to) {
+            const float* piece = &seg.samples[from];
+            int64_t count = to - from;
+            song_result.append(piece, count);
+            // The first segment was already given to the analysis while decoding
+            int64_t skip = max((int64_t)0, num_streamed - stitched);
+            if (count>skip) stream_out(piece + skip, count - skip);
+            stitched += count;
+        }
+        // Early end of file: the estimated duration was too long, the next segments are empty
+        bool early_end = seg.end>=0 && seg.first_sample + (int64_t)seg.samples.size() < seg.end;
+        vector<float>().swap(seg.samples);
+        if (early_end) break;
+    }
+    song_result.finish_appending();
+}
+
+Song_Loader::Status Song_Loader::finish(Song_Buffer& song, Song_Analysis& song_analysis)
+{
+    if (master.joinable()) master.join();
+    if (status==ABORTED) return status;
+    song_analysis = analysis;
+    if (song_result.empty()) return (status==OK) ? DECODE_ERROR : status;
+    song.swap(song_result);
+    song_result.clear();
+    return status;
+}
+
+uint64_t Song_Loader::hash_file(const std::string& filename, const std::atomic<bool>& aborted)
+{
+    // FNV-1a, but on 64-bit words instead of bytes: the file is read at disk speed,
+    // the hash only needs to tell different songs apart
+    const uint64_t prime = 1099511628211ULL;
+    uint64_t hash = 14695981039346656037ULL;
+    ifstream file(filename, ios::binary);
+    vector<uint64_t> buffer(1<<17);
+    while (file && !aborted) {
+        file.read(reinterpret_cast<char*>(&buffer[0]), buffer.size()*sizeof(uint64_t));
+        size_t nbytes = file.gcount();
+        if (nbytes==0) break;
+        // zero the tail of a partial last word
+        if (nbytes % sizeof(uint64_t)) memset(reinterpret_cast<char*>(&buffer[0]) + nbytes, 0, sizeof(uint64_t) - nbytes % sizeof(uint64_t));
+        size_t nwords = (nbytes + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+        for (size_t i=0; i<nwords; ++i) hash = (hash ^ buffer[i]) * prime;
+        hash = (hash ^ nbytes) * prime;
+    }
+    return hash;
+}
+
+std::string Song_Loader::cache_filename() const
+{
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)source_hash);
+    return cache_directory + "/song_" + hex + "_" + to_string(sample_rate) + (format==Song_Buffer::FLOAT32 ? ".pcm" : ".pcm16");
+}
+
+std::string Song_Loader::analysis_cache_filename() const
+{
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)source_hash);
+    return cache_directory + "/song_" + hex + "_" + to_string(sample_rate) + ".ana";
+}
+
+void Song_Loader::read_analysis()
+{
+    if (cache_directory.empty()) return;
+    ifstream file(analysis_cache_filename(), ios::binary);
+    if (!analysis.read_from(file) || analysis.sample_rate!=sample_rate) {
+        cerr << "Error: invalid cache " << analysis_cache_filename() << endl;
+        analysis.clear();
+    }
+}
+
+void Song_Loader::write_analysis()
+{
+    if (cache_directory.empty()) return;
+    string name = analysis_cache_filename();
+    string tmp_name = name + ".tmp";
+    {
+        ofstream file(tmp_name, ios::binary|ios::trunc);
+        if (!analysis.write_to(file)) {
+            file.close();
+            remove(tmp_name.c_str());
+            return;
+        }
+    }
+    if (rename(tmp_name.c_str(), name.c_str())) remove(tmp_name.c_str());
+}
+
+bool Song_Loader::read_from_cache()
+{
+    if (aborted || cache_directory.empty()) return false;
+    shared_ptr<Mapped_File> file = make_shared<Mapped_File>();
+    if (!file->open(cache_filename())) return false;
+    if (file->size()<sizeof(Cache_Header)) return false;
+    const Cache_Header* header = reinterpret_cast<const Cache_Header*>(file->data());
+    if (memcmp(header->magic, cache_magic, sizeof(cache_magic)) || header->source_hash!=source_hash
+        || header->sample_rate!=sample_rate || header->format!=format || header->num_samples<=0) {
+        cerr << "Error: invalid cache " << cache_filename() << endl;
+        return false;
+    }
+    Song_Buffer cached;
+    if (!cached.assign(file, sizeof(Cache_Header), header->num_samples, format)) {
+        cerr << "Error: truncated cache " << cache_filename() << endl;
+        return false;
+    }
+    num_decoded_samples = header->num_samples;
+    // start reading the beginning, to be played first
+    cached.prefetch(0, sample_rate * 10);
+    song_result.swap(cached);
+    return true;
+}
+
+void Song_Loader::write_to_cache()
+{
+    if (song_result.empty() || cache_directory.empty()) return;
+    Cache_Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, cache_magic, sizeof(cache_magic));
+    header.source_hash = source_hash;
+    header.sample_rate = sample_rate;
+    header.format = format;
+    header.num_samples = song_result.size();
+
+    // Write under a temporary name, so a partial file is never taken for a valid cache
+    string name = cache_filename();
+    string tmp_name = name + ".tmp";
+    {
+        ofstream file(tmp_name, ios::binary|ios::trunc);
+        file.write(reinterpret_cast<char*>(&header), sizeof(header));
+        if (!song_result.write_to(file)) {
+            file.close();
+            remove(tmp_name.c_str());
+            return;
+        }
+    }
+    if (rename(tmp_name.c_str(), name.c_str())) {
+        remove(tmp_name.c_str());
+        return;
+    }
+    // Now use the cache right away, so the song is not held twice in memory
+    // (the freshly written pages are still in the OS cache anyway)
+    read_from_cache();
+}
@@ -0,0 +1,156 @@
+/*
+  Analyseur de MUsique et ENtraînement au CHAnt
+
+  This file is released under either of the two licenses below, your choice:
+  - LGPL v2.1 or later, https://www.gnu.org
+    The GNU Lesser General Public Licence, version 2.1 or,
+    at your option, any later version.
+  - CeCILL-C, http://www.cecill.info
+    The CeCILL-C license is more adapted to the French laws,
+    but can be converted to the GNU LGPL.
+
+  You can use, modify and/or redistribute the software under the terms of any
+  of these licences, which should have been provided to you together with this
+  sofware. If that is not the case, you can find a copy of the licences on
+  the indicated web sites.
+
+  By Nicolas . Brodu @ Inria . fr
+
+  See http://nicolas.brodu.net/programmation/amuencha/ for more information
+*/
+
+#ifndef SONG_LOADER_H
+#define SONG_LOADER_H
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <algorithm>
+
+#include "song_buffer.h"
+#include "pcm_file.h"
+#include "song_analysis.h"
+#include "bounded_queue.h"
+
+// Decodes a song file into mono float samples at the given sampling rate.
+// Long files are cut into segments, each decoded on its own core by an
+// independent libav decoder seeked to the segment start. The segments are
+// then stitched back at sample-exact positions, computed from the frame
+// timestamps, after trimming the pre-roll decoded before each segment start.
+// The decoded samples are cached on disk, keyed by the file content and the
+// sampling rate, so that reopening the same song maps the cache directly
+// (when a cache directory is given).
+// Uncompressed WAV/AIFF files bypass libav and the cache altogether: they are
+// mapped and converted directly, or even used in place when already in the
+// song format, and only resampled when the rate differs.
+// Loading is a pipeline: decoding, resampling, and the song analysis stages
+// (onsets and tempo, chroma) each run on their own core, connected by bounded
+// queues, so each stage processes the song as soon as the previous one emits it.
+class Song_Loader
+{
+public:
+    enum Status {OK = 0, CANNOT_OPEN, NO_STREAM_INFO, NO_AUDIO_STREAM, NO_MEMORY, UNKNOWN_FORMAT, DECODE_ERROR, ABORTED};
+
+    Song_Loader();
+    ~Song_Loader();
+
+    // Checks the file can be decoded, then launches the decoding in the
+    // background and returns immediately
+    // The song is stored in the given format, see Song_Buffer
+    Status start(const std::string& filename, int sample_rate, Song_Buffer::Format format = Song_Buffer::FLOAT32);
+
+    // Directory holding the decoded PCM and analysis caches, which must exist
+    // Empty, the default, disables the caches. Set before start
+    void set_cache_directory(const std::string& directory) {cache_directory = directory;}
+
+    // Progress report, meant to be polled from the GUI thread
+    bool is_finished() const {return finished;}
+    int64_t get_estimated_num_samples() const {return estimated_num_samples;}
+    // the slowest stage of the pipeline sets the progress
+    int64_t get_num_processed_samples() const {
+        return std::min((int64_t)num_decoded_samples, std::min((int64_t)num_onset_samples, (int64_t)num_chroma_samples));
+    }
+    void abort() {aborted = true;}
+
+    // Waits for the decoding and the analysis to end, and moves the results into song and analysis
+    // song is left untouched when the loading was aborted or nothing could be decoded
+    // On DECODE_ERROR, song holds whatever could be decoded before the error
+    Status finish(Song_Buffer& song, Song_Analysis& analysis);
+
+protected:
+    // Segments shorter than this are not worth a decoder of their own (in seconds)
+    static constexpr float min_segment_duration = 30.f;
+    // Decoded before each segment start then trimmed, so the decoders can
+    // settle after the seek (bit reservoirs, resampler filter state...)
+    static constexpr float preroll_duration = 0.5f;
+    // Granularity of the song blocks given to the analysis stages, and their queue length
+    static const int analysis_block_size = 1<<14;
+    static const int analysis_queue_length = 64;
+
+    struct Segment {
+        // [start, end) in output samples, end<0 means up to the end of file
+        int64_t start = 0, end = -1;
+        // output sample index of samples[0], deduced from the first frame timestamp
+        int64_t first_sample = 0;
+        std::vector<float> samples;
+        Status status = OK;
+        // the decoder could not be placed at the segment start
+        bool misplaced = false;
+        std::thread thread;
+    };
+
+    void run();
+    void decode_segments();
+    // num_threads = 0 also moves the resampling to its own thread
+    // streamed segments feed the analysis while decoding
+    void decode_segment(Segment& segment, int num_threads, bool streamed);
+    void stitch();
+    void load_pcm();
+
+    // Analysis stages
+    void stream_out(const float* samples, int64_t count);
+    void stream_song(const Song_Buffer& song);
+    void run_onsets();
+    void run_chroma();
+
+    // Decoded PCM cache, see the Cache_Header layout in the .cpp
+    static uint64_t hash_file(const std::string& filename, const std::atomic<bool>& aborted);
+    std::string cache_filename() const;
+    bool read_from_cache();
+    void write_to_cache();
+    std::string analysis_cache_filename() const;
+    void read_analysis();
+    void write_analysis();
+
+    std::string filename;
+    std::string cache_directory;
+    int sample_rate = 0;
+    Song_Buffer::Format format = Song_Buffer::FLOAT32;
+    int64_t estimated_num_samples = 0;
+    int num_segments = 1;
+    uint64_t source_hash = 0;
+    PCM_Reader pcm;
+    bool use_pcm = false;
+
+    std::vector<Segment> segments;
+    Song_Buffer song_result;
+    Status status = OK;
+
+    Song_Analysis analysis;
+    // Blocks are shared by the two stages, each block is read-only once emitted
+    Bounded_Queue<std::shared_ptr<const std::vector<float>>> onset_queue {analysis_queue_length};
+    Bounded_Queue<std::shared_ptr<const std::vector<float>>> chroma_queue {analysis_queue_length};
+    int64_t num_streamed = 0;
+
+    std::thread master;
+    std::atomic<int64_t> num_decoded_samples {0};
+    std::atomic<int64_t> num_onset_samples {0};
+    std::atomic<int64_t> num_chroma_samples {0};
+    std::atomic<bool> finished {false};
+    std::atomic<bool> aborted {false};
+};
+
+#endif // SONG_LOADER_H
@@ -0,0 +1,175 @@
+/* 
+  Analyseur de MUsique et ENtraînement au CHAnt
+
+  This file is released under either of the two licenses below, your choice:
+  - LGPL v2.1 or later, https://www.gnu.org
+    The GNU Lesser General Public Licence, version 2.1 or,
+    at your option, any later version.
+  - CeCILL-C, http://www.cecill.info
+    The CeCILL-C license is more adapted to the French laws,
+    but can be converted to the GNU LGPL.
+  
+  You can use, modify and/or redistribute the software under the terms of any
+  of these licences, which should have been provided to you together with this
+  sofware. If that is not the case, you can find a copy of the licences on
+  the indicated web sites.
+  
+  By Nicolas . Brodu @ Inria . fr
+  
+  See http://nicolas.brodu.net/programmation/amuencha/ for more information
+*/
+
+
+#include <iostream>
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libavutil/imgutils.h>
+#include <libswscale/swscale.h>
+}
+
+#include "video_writer.h"
+
+using namespace std;
+
+Video_Writer::~Video_Writer()
+{
+    if (header_written) close();
+    release();
+}
+
+bool Video_Writer::open(const string& filename, int width, int height, int fps)
+{
+    release();
+    this->width = width;
+    this->height = height;
+    frame_index = 0;
+    
+    avformat_alloc_output_context2(&format_context, 0, 0, filename.c_str());
+    if (!format_context) {
+        cerr << "Error: no container format for " << filename << endl;
+        return false;
+    }
+    AVCodec* codec = avcodec_find_encoder(format_context->oformat->video_codec);
+    if (!codec) {
+        cerr << "Error: no video encoder for " << filename << endl;
+        release();
+        return false;
+    }
+    stream = avformat_new_stream(format_context, 0);
+    codec_context = avcodec_alloc_context3(codec);
+    if (!stream || !codec_context) {
+        cerr << "Error: cannot allocate the video stream" << endl;
+        release();
+        return false;
+    }
+    codec_context->width = width;
+    codec_context->height = height;
+    codec_context->time_base = AVRational{1, fps};
+    codec_context->framerate = AVRational{fps, 1};
+    codec_context->gop_size = fps;
+    codec_context->pix_fmt = codec->pix_fmts ? codec->pix_fmts[0] : AV_PIX_FMT_YUV420P;
+    if (format_context->oformat->flags & AVFMT_GLOBALHEADER) codec_context->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    if (avcodec_open2(codec_context, codec, 0) < 0
+     || avcodec_parameters_from_context(stream->codecpar, codec_context) < 0) {
+        cerr << "Error: cannot open the video encoder" << endl;
+        release();
+        return false;
+    }
+    stream->time_base = codec_context->time_base;
+    
+    frame = av_frame_alloc();
+    packet = av_packet_alloc();
+    if (!frame || !packet) {
+        cerr << "Error: cannot allocate the video frames" << endl;
+        release();
+        return false;
+    }
+    frame->format = codec_context->pix_fmt;
+    frame->width = width;
+    frame->height = height;
+    if (av_frame_get_buffer(frame, 32) < 0) {
+        cerr << "Error: cannot allocate the video frames" << endl;
+        release();
+        return false;
+    }
+    // AV_PIX_FMT_RGB32 is the native endian 0xAARRGGBB, same as QImage
+    sws_context = sws_getContext(width, height, AV_PIX_FMT_RGB32, width, height, codec_context->pix_fmt, SWS_BICUBIC, 0, 0, 0);
+    if (!sws_context) {
+        cerr << "Error: no conversion to the video pixel format" << endl;
+        release();
+        return false;
+    }
+    
+    if (!(format_context->oformat->flags & AVFMT_NOFILE)
+     && avio_open(&format_context->pb, filename.c_str(), AVIO_FLAG_WRITE) < 0) {
+        cerr << "Error: cannot write " << filename << endl;
+        release();
+        return false;
+    }
+    if (avformat_write_header(format_context, 0) < 0) {
+        cerr << "Error: cannot write the header of " << filename << endl;
+        release();
+        return false;
+    }
+    header_written = true;
+    return true;
+}
+
+bool Video_Writer::write(const uint8_t* pixels, int stride)
+{
+    if (!header_written) return false;
+    // the encoder may still hold a reference on the previous frame data
+    if (av_frame_make_writable(frame) < 0) return false;
+    sws_scale(sws_context, &pixels, &stride, 0, height, frame->data, frame->linesize);
+    frame->pts = frame_index++;
+    return encode(frame);
+}
+
+bool Video_Writer::encode(AVFrame* frame)
+{
+    if (avcodec_send_frame(codec_context, frame) < 0) {
+        cerr << "Error: video encoding failed" << endl;
+        return false;
+    }
+    while (true) {
+        int ret = avcodec_receive_packet(codec_context, packet);
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) return true;
+        if (ret < 0) {
+            cerr << "Error: video encoding failed" << endl;
+            return false;
+        }
+        av_packet_rescale_ts(packet, codec_context->time_base, stream->time_base);
+        packet->stream_index = stream->index;
+        // takes over the packet data
+        if (av_interleaved_write_frame(format_context, packet) < 0) {
+            cerr << "Error: cannot write the video packets" << endl;
+            return false;
+        }
+    }
+}
+
+bool Video_Writer::close()
+{
+    if (!header_written) return false;
+    header_written = false;
+    bool ok = encode(0);
+    if (av_write_trailer(format_context) < 0) ok = false;
+    release();
+    return ok;
+}
+
+void Video_Writer::release()
+{
+    if (format_context && format_context->pb && !(format_context->oformat->flags & AVFMT_NOFILE)) avio_closep(&format_context->pb);
+    if (format_context) avformat_free_context(format_context);
+    format_context = 0;
+    stream = 0;
+    avcodec_free_context(&codec_context);
+    av_frame_free(&frame);
+    av_packet_free(&packet);
+    sws_freeContext(sws_context);
+    sws_context = 0;
+    header_written = false;
+}
@@ -0,0 +1,67 @@
+/* 
+  Analyseur de MUsique et ENtraînement au CHAnt
+
+  This file is released under either of the two licenses below, your choice:
+  - LGPL v2.1 or later, https://www.gnu.org
+    The GNU Lesser General Public Licence, version 2.1 or,
+    at your option, any later version.
+  - CeCILL-C, http://www.cecill.info
+    The CeCILL-C license is more adapted to the French laws,
+    but can be converted to the GNU LGPL.
+  
+  You can use, modify and/or redistribute the software under the terms of any
+  of these licences, which should have been provided to you together with this
+  sofware. If that is not the case, you can find a copy of the licences on
+  the indicated web sites.
+  
+  By Nicolas . Brodu @ Inria . fr
+  
+  See http://nicolas.brodu.net/programmation/amuencha/ for more information
+*/
+
+
+#ifndef VIDEO_WRITER_H
+#define VIDEO_WRITER_H
+
+#include <string>
+#include <cstdint>
+
+struct AVFormatContext;
+struct AVCodecContext;
+struct AVStream;
+struct AVFrame;
+struct AVPacket;
+struct SwsContext;
+
+// Encodes 32-bit RGB frames (QImage::Format_RGB32 and ARGB32 layouts) into
+// a video file, with the default video codec of the container deduced from
+// the file name extension. Frames must be written in order.
+class Video_Writer
+{
+public:
+    Video_Writer() {}
+    ~Video_Writer();
+
+    bool open(const std::string& filename, int width, int height, int fps);
+    // stride in bytes between the rows of the pixels
+    bool write(const uint8_t* pixels, int stride);
+    // Flushes the encoder and completes the file
+    bool close();
+
+protected:
+    // sends frame to the encoder (0 flushes it) and writes the packets it returns
+    bool encode(AVFrame* frame);
+    void release();
+
+    AVFormatContext* format_context = 0;
+    AVCodecContext* codec_context = 0;
+    AVStream* stream = 0;
+    AVFrame* frame = 0;
+    AVPacket* packet = 0;
+    SwsContext* sws_context = 0;
+    int width = 0, height = 0;
+    int64_t frame_index = 0;
+    bool header_written = false;
+};
+
+#endif // VIDEO_WRITER_H
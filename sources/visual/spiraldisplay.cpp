@@ -19,19 +19,15 @@
   See http://nicolas.brodu.net/programmation/amuencha/ for more information
 */
 
+
 #include <QPainter>
-#include <QPainterPath>
-#include <QPointF>
+#include <QGuiApplication>
+#include <QScreen>
 //#include <QPalette>
 #include "spiraldisplay.h"
 
-#include <iostream>
-#include <fstream>
-#include <cmath>
-#include <complex>
-#include <boost/math/constants/constants.hpp>
+#include <chrono>
 
-using namespace boost::math::float_constants;
 using namespace std;
 
 SpiralDisplay::SpiralDisplay(QWidget *parent) : QWidget(parent)
@@ -41,242 +37,130 @@ SpiralDisplay::SpiralDisplay(QWidget *parent) : QWidget(parent)
     setAutoFillBackground(true);
     setPalette(pal);
     
-    // 12ET
-    // Other music systems like are best kept for later... but doable in practice
-    // with different base note (A440 here) and different note names, splits, etc
-    note_positions.resize(12);
-    for (int i=0; i<12; ++i) note_positions[i] = polar(0.9, half_pi-i*two_pi/12.);
-    note_names.resize(12);
-    note_names = {"C", "C#", "D", "D#", "E", "F", "F#", "G", "G#", "A", "A#", "B"};
-    
-    display_spectrum.resize(num_ID);
-    all_spirals.resize(num_ID);
+    set_max_fps(0);
+    render_thread = thread(&SpiralDisplay::render_loop, this);
 }
 
-void SpiralDisplay::set_min_max_notes(int min_midi_note, int max_midi_note) 
+SpiralDisplay::~SpiralDisplay()
 {
-    if (max_midi_note<min_midi_note) swap(min_midi_note, max_midi_note);
-    
-    this->min_midi_note = min_midi_note;
-    this->max_midi_note = max_midi_note;
-    display_bins.clear();
-    QPainterPath empty;
-    base_spiral.swap(empty);
-    for(int id=0; id<num_ID; ++id) all_spirals[id].clear();
-    update();
+    {
+        lock_guard<mutex> lock(request_mutex);
+        quit_render = true;
+        render_condition.notify_one();
+    }
+    render_thread.join();
 }
 
-void SpiralDisplay::set_gain(float gain)
+void SpiralDisplay::set_min_max_notes(int min_midi_note, int max_midi_note) 
 {
-    this->gain = gain;
+    {
+        Geometry_Lock lock(this);
+        renderer.set_min_max_notes(min_midi_note, max_midi_note);
+    }
+    request_render();
 }
 
-QString SpiralDisplay::get_note_name_and_frequency(int midi_note)
+void SpiralDisplay::set_bins_per_semitone(int bins)
 {
-    const float fref = 440;
-    const float log2_fref = log2(fref);
-    const int aref = 69; // use the midi numbering scheme, because why not
-    float f = exp2((midi_note - aref)/12. + log2_fref);
-    int octave_number = midi_note/12 - 2;
-    return note_names[midi_note%12]+QString::number(octave_number)+" ("+QString::number(f,'f',3)+"Hz)";
+    Geometry_Lock lock(this);
+    renderer.set_bins_per_semitone(bins);
 }
 
-void SpiralDisplay::compute_frequencies()
+void SpiralDisplay::set_gain(float gain)
 {
-    const float w = width();
-    const float h = height();
-    const float hw = w<h ? w : h;
-    // Now the spiral
-    // Start with A440, but this could be parametrizable as well
-    const float fref = 440;
-    const float log2_fref = log2(fref);
-    const int aref = 69; // use the midi numbering scheme, because why not
-    float log2_fmin = (min_midi_note - aref)/12. + log2_fref;
-    float log2_fmax = (max_midi_note - aref)/12. + log2_fref;
-    int approx_pix_bin_width = 3;
-    // number of frequency bins is the number of pixels
-    // along the spiral path / approx_pix_bin_width 
-    // According to mathworld, the correct formula for the path length
-    // from the origin involves sqrt and log computations.
-    // Here, we just want some approximate pixel count
-    // => use all circles for the approx
-    int num_octaves = (max_midi_note - min_midi_note +11)/12;
-    float approx_num_pix = 0.5 * hw * pi * num_octaves;
-    int num_bins = (int)(approx_num_pix / approx_pix_bin_width);
-    // one more bound than number of bins
-    display_bins.resize(num_bins+1);
-    bin_sizes.resize(num_bins);
-    spiral_positions.resize(num_bins+1);
-    spiral_r_a.resize(num_bins+1);
-    const float rmin = 0.1;
-    const float rmax = 0.9;
-    // The spiral and bounds are the same independently of how 
-    // the log space is divided into notes (e.g. 12ET)
-    // Make it so c is on the y axis. Turn clockwise because people are 
-    // used to it (e.g. wikipedia note circle)
-    const float theta_min = half_pi - two_pi*(min_midi_note%12)/12;
-    // wrap in anti-trigonometric direction
-    const float theta_max = theta_min - two_pi*(max_midi_note - min_midi_note)/12;
-    
-    frequencies.resize(num_bins);
-    for (int b=0; b<num_bins; ++b) {
-        float bratio = (float)b/(num_bins-1.);
-        frequencies[b] = exp2(log2_fmin + (log2_fmax - log2_fmin) * bratio);
-    }
-    for (int b=0; b<=num_bins; ++b) {
-        float bratio = (float)(b-0.5)/(float)(num_bins-1.);
-        display_bins[b] = exp2(log2_fmin + (log2_fmax - log2_fmin) * bratio);
-        spiral_r_a[b].r = rmin + (rmax - rmin) * bratio;
-        spiral_r_a[b].a = theta_min + (theta_max - theta_min) * bratio;
-        spiral_positions[b] = polar(spiral_r_a[b].r, spiral_r_a[b].a);
-    }
-    for (int b=0; b<num_bins; ++b) {
-        bin_sizes[b] = display_bins[b+1]-display_bins[b];
-    }
-    for (int id=0; id<num_ID; ++id) {
-        display_spectrum[id].resize(num_bins);
-        fill(display_spectrum[id].begin(), display_spectrum[id].end(), 0.);
-    }
+    renderer.set_gain(gain);
+    request_render();
 }
 
 void SpiralDisplay::power_handler(int ID, const vector<float>& reassigned_frequencies, const vector<float>& power_spectrum)
 {
-    
-    fill(display_spectrum[ID].begin(), display_spectrum[ID].end(), 0.);
-    
-    // simple histogram-like sum, assuming power entries are normalized
-    int nidx = reassigned_frequencies.size();
-    for (int idx=0; idx<nidx; ++idx) {
-        float rf = reassigned_frequencies[idx];
-        int ri = idx;
-        // reassigned frequencies are never too far off the original
-        //if (rf>display_bins[idx] && rf<display_bins[idx+1]) ri = idx;
-        //else...
-        while (rf<display_bins[ri]) {
-            --ri;
-            if (ri==-1) break;
-        }
-        if (ri==-1) continue; // ignore this frequency, it is below display min
-        while (rf>display_bins[ri+1]) {
-            ++ri;
-            if (ri==nidx) break;
-        }
-        if (ri==nidx) continue; // ignore this frequency, it is above display max
-        
-        // Normalization:
-        // - for a given frequency, the sine/window size dependency was already
-        //   handled in the frequency analyzer
-        // - but the result should not depend on how many frequencies are provided:
-        //   increasing the resolution should not increase the power
-        // => we need a kind of density, not just the histogram-like sum of powers
-        //    falling into each bin
-        // - consider the energy is coming from all the original bin size & sum
-        // - This way, using finer bins do not increase the total sum
-        display_spectrum[ID][ri] += power_spectrum[idx] * bin_sizes[idx];
+    {
+        // The analyzer never waits for the GUI: while the geometry changes,
+        // this spectrum is dropped, the next one follows shortly
+        unique_lock<mutex> lock(mapping_mutex[ID], try_to_lock);
+        if (!lock.owns_lock()) return;
+        if (!renderer.map_spectrum(ID, reassigned_frequencies, power_spectrum)) return;
     }
-    
-    // - Then, spread on the destination bin for getting uniform density
-    //   measure independently of the target bin size
-    for (int idx=0; idx<nidx; ++idx) display_spectrum[ID][idx] /= bin_sizes[idx];
-
-    this->update();
+    request_render(ID);
 }
 
 void SpiralDisplay::set_visual_fading(int value)
 {
-    visual_fading = max(1,value);
+    renderer.set_visual_fading(value);
 }
-    
-void SpiralDisplay::paintEvent(QPaintEvent *event) {
-    QPainter painter(this);
-    const float w = width();
-    const float h = height();
-    const float hw = w<h ? w : h;
-    const float w_half = w * 0.5;
-    const float h_half = h * 0.5;
-    const float hw_half = hw*0.5;
-    auto xy = [&](float x, float y) {
-        //return QPointF((x+1.)*.5*width(), (1.-y)*.5*height());
-        return QPointF(w_half + x * hw_half, h_half - y * hw_half);
-    };
-    
-    if (display_bins.empty()) {
-        compute_frequencies();
-    }
-    
-    painter.setPen(Qt::black);
-    painter.setRenderHint(QPainter::Antialiasing, true);
-    QFont font = painter.font();
-    font.setPointSize(font.pointSizeF()*1.1);
-    QPainterPath path;
-    // twelve notes, TODO = temperament. Here 12ET
-    for (int i=0; i<12; ++i) {
-        path.moveTo(xy(0.,0.));
-        path.lineTo(xy(note_positions[i].real(), note_positions[i].imag()));
-        painter.drawText(xy(note_positions[i].real()*1.05-0.02, note_positions[i].imag()*1.05-0.01), note_names[i]);
+
+void SpiralDisplay::set_max_fps(float fps)
+{
+    if (fps<=0) {
+        QScreen* screen = QGuiApplication::primaryScreen();
+        fps = screen ? screen->refreshRate() : 0;
+        if (fps<=0) fps = 60;
     }
-    painter.drawPath(path);
-    
-    int num_octaves = (max_midi_note - min_midi_note +11)/12;
-    
-    for (int id=0; id<num_ID; ++id) {
-        QPainterPath power_spiral;
-        power_spiral.moveTo(xy(spiral_positions[0].real(),spiral_positions[0].imag()));
-        for (int b=0; b<display_spectrum[id].size(); ++b) {
-            float amplitude = 0.8/num_octaves * min(1.f, display_spectrum[id][b] * gain);
-            //if (display_spectrum[id][b]>0) cout << display_spectrum[id][b] << endl;
-            // power normalised between 0 and 1 => 0.1 = spiral branch
-            float r = spiral_r_a[b].r + amplitude;
-            auto p = polar(r, spiral_r_a[b].a);
-            power_spiral.lineTo(xy(p.real(),p.imag()));
-            r = spiral_r_a[b+1].r + amplitude;
-            p = polar(r, spiral_r_a[b+1].a);
-            power_spiral.lineTo(xy(p.real(),p.imag()));
-        }
-        for (int b=spiral_positions.size()-1; b>=0; --b) {
-            power_spiral.lineTo(xy(spiral_positions[b].real(),spiral_positions[b].imag()));
-        }
-        
-        int nspirals = all_spirals[id].size();
-        if (nspirals>=visual_fading) {
-            for (int vf = visual_fading; vf<=nspirals; ++vf) all_spirals[id].pop_front();
-            nspirals=visual_fading;
+    frame_interval_us = (int)(1e6f / fps);
+}
+
+void SpiralDisplay::request_render(int ID)
+{
+    lock_guard<mutex> lock(request_mutex);
+    dirty_sources |= ID<0 ? (1u<<num_ID)-1 : 1u<<ID;
+    render_condition.notify_one();
+}
+
+void SpiralDisplay::render_loop()
+{
+    using namespace std::chrono;
+    steady_clock::time_point next_frame = steady_clock::now();
+    while (true) {
+        unsigned int dirty;
+        {
+            unique_lock<mutex> lock(request_mutex);
+            // nothing changed, no frame at all
+            render_condition.wait(lock, [this]() {return dirty_sources || quit_render;});
+            if (quit_render) break;
+            // at most one frame per display refresh: the requests arriving
+            // until then, from both sources, are merged into that frame
+            if (render_condition.wait_until(lock, next_frame, [this]() {return quit_render;})) break;
+            dirty = dirty_sources;
+            dirty_sources = 0;
         }
-        else ++nspirals;
-        all_spirals[id].emplace_back(power_spiral.simplified());
+        next_frame = steady_clock::now() + microseconds(frame_interval_us);
         
-        int spidx = 1;
-        for (const auto& spiral: all_spirals[id]) {
-            // whitefactor is 0 for the newest one
-            int whitefactor = 255 - 255*spidx/nspirals;
-            QColor c;
-            if (id==1) c = QColor::fromRgb(255,whitefactor,whitefactor);
-            else c = QColor::fromRgb(whitefactor,whitefactor,255);
-            painter.setBrush(c);
-            painter.setPen(c);
-            painter.drawPath(spiral);
-            ++spidx;
+        lock_guard<mutex> lock(render_mutex);
+        // reuse the previous frame buffer, unless the GUI still holds it
+        QSize device_size = renderer.get_device_size();
+        if (back_frame.size()!=device_size || !back_frame.isDetached()) {
+            back_frame = QImage(device_size, QImage::Format_ARGB32_Premultiplied);
         }
-    }
-    
-    // Overlay the base spiral in black
-    if (base_spiral.isEmpty()) {
-        base_spiral.moveTo(xy(spiral_positions.back().real(),spiral_positions.back().imag()));
-        for (int b=spiral_positions.size()-1; b>=0; --b) {
-            base_spiral.lineTo(xy(spiral_positions[b].real(),spiral_positions[b].imag()));
+        back_frame.setDevicePixelRatio(renderer.get_ratio());
+        if (!renderer.render(back_frame, dirty)) continue;
+        {
+            lock_guard<mutex> frame_lock(frame_mutex);
+            swap(finished_frame, back_frame);
         }
-        //base_spiral = base_spiral.simplified();
+        // the widget itself can only be painted from the GUI thread
+        QMetaObject::invokeMethod(this, "update", Qt::QueuedConnection);
     }
+}
 
-    painter.setPen(Qt::black);
-    painter.setBrush(Qt::NoBrush);
-    painter.drawPath(base_spiral);
-    
+void SpiralDisplay::paintEvent(QPaintEvent *event)
+{
+    // Only blit the last finished frame, which is shared, not copied
+    QImage frame;
+    {
+        lock_guard<mutex> lock(frame_mutex);
+        frame = finished_frame;
+    }
+    // the white background is already there until the first frame
+    if (frame.isNull()) return;
+    QPainter painter(this);
+    painter.drawImage(QPointF(0, 0), frame);
 }
 
 void SpiralDisplay::resizeEvent(QResizeEvent *event)
 {
-    QPainterPath emptyPath;
-    base_spiral.swap(emptyPath);
-    for (int id=0; id<num_ID; ++id) all_spirals[id].clear();
+    {
+        Geometry_Lock lock(this);
+        renderer.set_size(size(), devicePixelRatioF());
+    }
+    request_render();
 }
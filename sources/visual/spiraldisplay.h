@@ -19,32 +19,42 @@
   See http://nicolas.brodu.net/programmation/amuencha/ for more information
 */
 
+
 #ifndef SPIRAL_DISPLAY_H
 #define SPIRAL_DISPLAY_H
 
 #include <QWidget>
 #include <QPaintEvent>
+#include <QImage>
 
 #include <vector>
-#include <list>
-#include <complex>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include "spiralrenderer.h"
 
 class SpiralDisplay : public QWidget
 {
     Q_OBJECT
 public:
     explicit SpiralDisplay(QWidget *parent = 0);
+    ~SpiralDisplay();
     
     void set_min_max_notes(int min_midi_note, int max_midi_note);
+    // Resolution of the analysis, independent of the widget size
+    void set_bins_per_semitone(int bins);
     void set_gain(float gain);
 
-    inline float get_min_frequency() {return display_bins.front();}
-    inline float get_max_frequency() {return display_bins.back();}
+    inline float get_min_frequency() {return renderer.get_frequencies().front();}
+    inline float get_max_frequency() {return renderer.get_frequencies().back();}
     
-    QString get_note_name_and_frequency(int midi_note);
+    QString get_note_name_and_frequency(int midi_note) {return renderer.get_note_name_and_frequency(midi_note);}
     
-    // central frequencies (log space)
-    std::vector<float> frequencies;
+    // central frequencies (log space) given to the analyzers
+    // The display resamples the spectrum on its own pixel bins
+    const std::vector<float>& get_frequencies() const {return renderer.get_frequencies();}
     
     // Callback when the power spectrum is available at the prescribed frequencies
     // The ID is that of the caller, setting the color of the display
@@ -52,35 +62,55 @@ public:
     
     void set_visual_fading(int value);
     
-    static const int num_ID = 2;
-    
-protected:
-    int min_midi_note, max_midi_note;
-    float gain = 1;
+    // At most that many frames are rendered per second, requests in between
+    // are merged. fps<=0 follows the screen refresh rate
+    void set_max_fps(float fps);
     
-    void compute_frequencies();
+    static const int num_ID = SpiralRenderer::num_ID;
     
-    // local copy for maintaining the display, adapted to the drawing bins
-    std::vector<std::vector<float>> display_spectrum;
+protected:
+    SpiralRenderer renderer;
     
-    // bin low bounds, each bin consists of [f_b, f_b+1)
-    std::vector<float> display_bins;
-    // duplicate info for faster processing = delta_f in each bin
-    std::vector<float> bin_sizes;
+    // Held by the power handler of each source while mapping its spectrum,
+    // which only contends with the GUI thread changing the geometry.
+    // The spectra themselves reach the render thread without any lock,
+    // see SpiralRenderer::Spectrum_Buffer
+    std::mutex mapping_mutex[num_ID];
+    // Locks out the render thread and all the power handlers while the
+    // GUI thread changes the geometry
+    struct Geometry_Lock {
+        SpiralDisplay* display;
+        Geometry_Lock(SpiralDisplay* display) : display(display) {
+            display->render_mutex.lock();
+            for (auto& m: display->mapping_mutex) m.lock();
+        }
+        ~Geometry_Lock() {
+            for (auto& m: display->mapping_mutex) m.unlock();
+            display->render_mutex.unlock();
+        }
+    };
     
-    // xy position of that frequency bin bound on the spiral
-    std::vector<std::complex<float>> spiral_positions;
-    // same info, but r.exp(angle)
-    // avoid all the sqrt, cos and sin at each redraw
-    struct Radius_Angle {float r, a;};
-    std::vector<Radius_Angle> spiral_r_a;
-    // 12ET by default
-    std::vector<std::complex<float>> note_positions;
-    std::vector<QString> note_names;
-
-    std::vector<std::list<QPainterPath>> all_spirals;
-    QPainterPath base_spiral;
-    int visual_fading;
+    // The spiral is rendered into an image on its own thread, so heavy frames
+    // do not slow down the GUI. paintEvent only draws the last finished frame.
+    void render_loop();
+    // marks the source dirty (all of them for ID<0) and wakes up the render
+    // thread, callable from any thread
+    void request_render(int ID = -1);
+    std::thread render_thread;
+    std::mutex request_mutex;
+    std::condition_variable render_condition;
+    // one bit per source ID
+    unsigned int dirty_sources = 0;
+    bool quit_render = false;
+    std::atomic<int> frame_interval_us {16667};
+    // Held for a whole frame by the render thread, and by the GUI thread
+    // while changing the geometry: notes, frequencies, widget size
+    // Always taken before the mapping mutexes
+    std::mutex render_mutex;
+    QImage back_frame;
+    // the last finished frame, swapped with back_frame under frame_mutex
+    std::mutex frame_mutex;
+    QImage finished_frame;
     
     // QWidget interface
     void paintEvent(QPaintEvent *event);
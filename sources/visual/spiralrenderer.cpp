@@ -0,0 +1,439 @@
+/* 
+  Analyseur de MUsique et ENtraînement au CHAnt
+
+  This file is released under either of the two licenses below, your choice:
+  - LGPL v2.1 or later, https://www.gnu.org
+    The GNU Lesser General Public Licence, version 2.1 or,
+    at your option, any later version.
+  - CeCILL-C, http://www.cecill.info
+    The CeCILL-C license is more adapted to the French laws,
+    but can be converted to the GNU LGPL.
+  
+  You can use, modify and/or redistribute the software under the terms of any
+  of these licences, which should have been provided to you together with this
+  sofware. If that is not the case, you can find a copy of the licences on
+  the indicated web sites.
+  
+  By Nicolas . Brodu @ Inria . fr
+  
+  See http://nicolas.brodu.net/programmation/amuencha/ for more information
+*/
+
+
+#include <QPainter>
+#include <QPointF>
+#include "spiralrenderer.h"
+
+#include <cmath>
+#include <complex>
+#include <cstring>
+#include <algorithm>
+#include <boost/math/constants/constants.hpp>
+
+using namespace boost::math::float_constants;
+using namespace std;
+
+namespace {
+typedef uint32_t v4su __attribute__ ((vector_size (16)));
+
+// Multiplies all channels of a premultiplied ARGB image by factor/256
+// The pixels are processed 4 at a time, and 2 channels at a time within
+// each pixel, each in its own 16-bit lane. Rounding down ensures the
+// faded pixels eventually reach full transparency.
+void fade_image(QImage& image, uint32_t factor)
+{
+    if (factor==0) {
+        image.fill(Qt::transparent);
+        return;
+    }
+    uint32_t* pixels = reinterpret_cast<uint32_t*>(image.bits());
+    int64_t count = (int64_t)image.bytesPerLine() / 4 * image.height();
+    const v4su rb_mask = {0x00FF00FF, 0x00FF00FF, 0x00FF00FF, 0x00FF00FF};
+    const v4su f = {factor, factor, factor, factor};
+    int64_t i = 0;
+    for (; i+4<=count; i+=4) {
+        v4su p;
+        memcpy(&p, pixels+i, sizeof(p));
+        v4su rb = (((p & rb_mask) * f) >> 8) & rb_mask;
+        v4su ag = (((p >> 8) & rb_mask) * f) & ~rb_mask;
+        p = rb | ag;
+        memcpy(pixels+i, &p, sizeof(p));
+    }
+    for (; i<count; ++i) {
+        uint32_t p = pixels[i];
+        pixels[i] = ((((p & 0x00FF00FF) * factor) >> 8) & 0x00FF00FF)
+                  | ((((p >> 8) & 0x00FF00FF) * factor) & 0xFF00FF00);
+    }
+}
+}
+
+SpiralRenderer::SpiralRenderer()
+{
+    // 12ET
+    // Other music systems like are best kept for later... but doable in practice
+    // with different base note (A440 here) and different note names, splits, etc
+    note_positions.resize(12);
+    for (int i=0; i<12; ++i) note_positions[i] = polar(0.9, half_pi-i*two_pi/12.);
+    note_names.resize(12);
+    note_names = {"C", "C#", "D", "D#", "E", "F", "F#", "G", "G#", "A", "A#", "B"};
+    
+    mapping_scratch.resize(num_ID);
+    fading_images.resize(num_ID);
+}
+
+void SpiralRenderer::set_min_max_notes(int min_midi_note, int max_midi_note) 
+{
+    if (max_midi_note<min_midi_note) swap(min_midi_note, max_midi_note);
+    this->min_midi_note = min_midi_note;
+    this->max_midi_note = max_midi_note;
+    compute_frequencies();
+    compute_display_bins();
+    clear_drawing();
+}
+
+void SpiralRenderer::set_bins_per_semitone(int bins)
+{
+    bins_per_semitone = max(1, bins);
+    compute_frequencies();
+}
+
+void SpiralRenderer::set_size(QSize size, qreal ratio)
+{
+    this->size = size;
+    this->ratio = ratio;
+    // the analysis frequencies do not depend on the size, only the display bins
+    compute_display_bins();
+    clear_drawing();
+}
+
+void SpiralRenderer::clear_drawing()
+{
+    QPainterPath empty;
+    base_spiral.swap(empty);
+    spiral_outline.clear();
+    clear_fading();
+}
+
+void SpiralRenderer::clear_fading()
+{
+    for (int id=0; id<num_ID; ++id) fading_images[id] = QImage();
+}
+
+QString SpiralRenderer::get_note_name_and_frequency(int midi_note) const
+{
+    const float fref = 440;
+    const float log2_fref = log2(fref);
+    const int aref = 69; // use the midi numbering scheme, because why not
+    float f = exp2((midi_note - aref)/12. + log2_fref);
+    int octave_number = midi_note/12 - 2;
+    return note_names[midi_note%12]+QString::number(octave_number)+" ("+QString::number(f,'f',3)+"Hz)";
+}
+
+void SpiralRenderer::compute_frequencies()
+{
+    // Start with A440, but this could be parametrizable as well
+    const float fref = 440;
+    const float log2_fref = log2(fref);
+    const int aref = 69; // use the midi numbering scheme, because why not
+    float log2_fmin = (min_midi_note - aref)/12. + log2_fref;
+    // Uniform in log space, whatever the widget size: resizing the window
+    // neither changes the analysis cost nor invalidates the analyzers
+    int num_bins = (max_midi_note - min_midi_note) * bins_per_semitone + 1;
+    const float step = 1.f / (12 * bins_per_semitone); // in octaves
+    // each bin spans half a step on each side of its frequency
+    const float width_ratio = exp2(0.5f * step) - exp2(-0.5f * step);
+    frequencies.resize(num_bins);
+    analysis_bin_sizes.resize(num_bins);
+    for (int b=0; b<num_bins; ++b) {
+        frequencies[b] = exp2(log2_fmin + b * step);
+        analysis_bin_sizes[b] = frequencies[b] * width_ratio;
+    }
+}
+
+void SpiralRenderer::compute_display_bins()
+{
+    const float w = size.width();
+    const float h = size.height();
+    const float hw = w<h ? w : h;
+    // Now the spiral
+    // Start with A440, but this could be parametrizable as well
+    const float fref = 440;
+    const float log2_fref = log2(fref);
+    const int aref = 69; // use the midi numbering scheme, because why not
+    float log2_fmin = (min_midi_note - aref)/12. + log2_fref;
+    float log2_fmax = (max_midi_note - aref)/12. + log2_fref;
+    int approx_pix_bin_width = 3;
+    // number of frequency bins is the number of pixels
+    // along the spiral path / approx_pix_bin_width 
+    // According to mathworld, the correct formula for the path length
+    // from the origin involves sqrt and log computations.
+    // Here, we just want some approximate pixel count
+    // => use all circles for the approx
+    int num_octaves = (max_midi_note - min_midi_note +11)/12;
+    float approx_num_pix = 0.5 * hw * pi * num_octaves;
+    int num_bins = (int)(approx_num_pix / approx_pix_bin_width);
+    // not laid out yet
+    if (num_bins<2) num_bins = 0;
+    // one more bound than number of bins
+    display_bins.resize(num_bins ? num_bins+1 : 0);
+    bin_sizes.resize(num_bins);
+    spiral_positions.resize(display_bins.size());
+    spiral_r_a.resize(display_bins.size());
+    spiral_cos.resize(display_bins.size());
+    spiral_sin.resize(display_bins.size());
+    const float rmin = 0.1;
+    const float rmax = 0.9;
+    // The spiral and bounds are the same independently of how 
+    // the log space is divided into notes (e.g. 12ET)
+    // Make it so c is on the y axis. Turn clockwise because people are 
+    // used to it (e.g. wikipedia note circle)
+    const float theta_min = half_pi - two_pi*(min_midi_note%12)/12;
+    // wrap in anti-trigonometric direction
+    const float theta_max = theta_min - two_pi*(max_midi_note - min_midi_note)/12;
+    
+    for (int b=0; b<(int)display_bins.size(); ++b) {
+        float bratio = (float)(b-0.5)/(float)(num_bins-1.);
+        display_bins[b] = exp2(log2_fmin + (log2_fmax - log2_fmin) * bratio);
+        spiral_r_a[b].r = rmin + (rmax - rmin) * bratio;
+        spiral_r_a[b].a = theta_min + (theta_max - theta_min) * bratio;
+        spiral_cos[b] = cos(spiral_r_a[b].a);
+        spiral_sin[b] = sin(spiral_r_a[b].a);
+        spiral_positions[b] = complex<float>(spiral_r_a[b].r * spiral_cos[b], spiral_r_a[b].r * spiral_sin[b]);
+    }
+    inv_bin_sizes.resize(num_bins);
+    for (int b=0; b<num_bins; ++b) {
+        bin_sizes[b] = display_bins[b+1]-display_bins[b];
+        inv_bin_sizes[b] = 1.f / bin_sizes[b];
+    }
+    compute_bin_grid();
+    for (int id=0; id<num_ID; ++id) spectrum_buffers[id].resize(num_bins);
+}
+
+void SpiralRenderer::Spectrum_Buffer::resize(int num_bins)
+{
+    // only while nothing is mapped nor rendered
+    for (auto& spectrum: spectra) spectrum.assign(num_bins, 0.f);
+    middle = 1;
+    back = 0;
+    front = 2;
+}
+
+bool SpiralRenderer::map_spectrum(int ID, const vector<float>& reassigned_frequencies, const vector<float>& power_spectrum)
+{
+    Spectrum_Buffer& buffer = spectrum_buffers[ID];
+    vector<float>& spectrum = buffer.back_spectrum();
+    fill(spectrum.begin(), spectrum.end(), 0.);
+    
+    int nidx = reassigned_frequencies.size();
+    int num_bins = bin_sizes.size();
+    // not laid out yet, or stale analyzer
+    if (bin_grid.empty() || nidx!=(int)analysis_bin_sizes.size()) return false;
+    const float fmin = display_bins.front();
+    const float fmax = nextafterf(display_bins.back(), 0.f);
+    
+    // Resampling on the display bins:
+    // - for a given frequency, the sine/window size dependency was already
+    //   handled in the frequency analyzer
+    // - but the result should not depend on how many frequencies are provided:
+    //   increasing the resolution should not increase the power
+    // => we need a kind of density, not just the histogram-like sum of powers
+    //    falling into each bin
+    // - consider the energy is coming from all the original analysis bin
+    //   size, spread uniformly over that size around the reassigned frequency
+    // - the display bins it overlaps get their share of it, so the result
+    //   does not depend on the display resolution either
+    Mapping_Scratch& scratch = mapping_scratch[ID];
+    scratch.low.resize(nidx);
+    scratch.high.resize(nidx);
+    scratch.low_cells.resize(nidx);
+    scratch.high_cells.resize(nidx);
+    float* low = scratch.low.data();
+    float* high = scratch.high.data();
+    for (int idx=0; idx<nidx; ++idx) {
+        float half_size = 0.5f * analysis_bin_sizes[idx];
+        low[idx] = max(fmin, reassigned_frequencies[idx] - half_size);
+        high[idx] = min(fmax, reassigned_frequencies[idx] + half_size);
+    }
+    grid_cells(low, nidx, scratch.low_cells.data());
+    grid_cells(high, nidx, scratch.high_cells.data());
+    
+    for (int idx=0; idx<nidx; ++idx) {
+        // ignore the frequencies entirely outside the display
+        if (!(low[idx]<high[idx])) continue;
+        int first = display_bin(low[idx], scratch.low_cells[idx]);
+        int last = display_bin(high[idx], scratch.high_cells[idx]);
+        float power = power_spectrum[idx];
+        if (first==last) {
+            spectrum[first] += power * (high[idx] - low[idx]);
+            continue;
+        }
+        spectrum[first] += power * (display_bins[first+1] - low[idx]);
+        for (int b=first+1; b<last; ++b) spectrum[b] += power * bin_sizes[b];
+        spectrum[last] += power * (high[idx] - display_bins[last]);
+    }
+    
+    // - Then, spread on the destination bin for getting uniform density
+    //   measure independently of the target bin size
+    for (int b=0; b<num_bins; ++b) spectrum[b] *= inv_bin_sizes[b];
+    buffer.publish();
+    return true;
+}
+
+void SpiralRenderer::grid_cells(const float* frequencies, int count, uint32_t* cells) const
+{
+    const uint32_t* bits = reinterpret_cast<const uint32_t*>(frequencies);
+    const v4su base = {bin_grid_base, bin_grid_base, bin_grid_base, bin_grid_base};
+    int i = 0;
+    for (; i+4<=count; i+=4) {
+        v4su b;
+        memcpy(&b, bits+i, sizeof(b));
+        b = (b >> bin_grid_shift) - base;
+        memcpy(cells+i, &b, sizeof(b));
+    }
+    for (; i<count; ++i) cells[i] = (bits[i] >> bin_grid_shift) - bin_grid_base;
+}
+
+void SpiralRenderer::compute_bin_grid()
+{
+    int num_bins = bin_sizes.size();
+    bin_grid.clear();
+    if (num_bins<1) return;
+    auto float_bits = [](float f) {uint32_t u; memcpy(&u, &f, sizeof(u)); return u;};
+    // The mantissa bits read as an integer are linear in the frequency
+    // within an octave, so a cell spans up to 1/ln(2) = 1.44 times its
+    // nominal log2 width. The narrowest bin must still hold a whole cell.
+    float min_log2_width = log2(display_bins[1] / display_bins[0]);
+    for (int b=1; b<num_bins; ++b) min_log2_width = min(min_log2_width, log2(display_bins[b+1] / display_bins[b]));
+    int mantissa_bits = (int)ceil(log2(1.4427f / min_log2_width)) + 1;
+    mantissa_bits = max(0, min(23, mantissa_bits));
+    bin_grid_shift = 23 - mantissa_bits;
+    bin_grid_base = float_bits(display_bins.front()) >> bin_grid_shift;
+    uint32_t grid_end = float_bits(display_bins.back()) >> bin_grid_shift;
+    bin_grid.resize(grid_end - bin_grid_base + 1);
+    int b = 0;
+    for (uint32_t cell=0; cell<bin_grid.size(); ++cell) {
+        uint32_t cell_bits = (bin_grid_base + cell) << bin_grid_shift;
+        float cell_min;
+        memcpy(&cell_min, &cell_bits, sizeof(cell_min));
+        while (b<num_bins-1 && cell_min>=display_bins[b+1]) ++b;
+        bin_grid[cell] = b;
+    }
+}
+
+void SpiralRenderer::set_visual_fading(int value)
+{
+    visual_fading = max(1,value);
+    // Exponential fading, which a single multiplication per frame can
+    // maintain: after visual_fading frames only fading_floor is left
+    if (visual_fading==1) fading_factor = 0;
+    else fading_factor = (int)(256 * pow(fading_floor, 1.f/visual_fading));
+}
+
+bool SpiralRenderer::render(QImage& frame, unsigned int dirty_sources)
+{
+    const float w = size.width();
+    const float h = size.height();
+    const float hw = w<h ? w : h;
+    const float w_half = w * 0.5;
+    const float h_half = h * 0.5;
+    const float hw_half = hw*0.5;
+    auto xy = [&](float x, float y) {
+        //return QPointF((x+1.)*.5*width(), (1.-y)*.5*height());
+        return QPointF(w_half + x * hw_half, h_half - y * hw_half);
+    };
+    
+    // not ready to be drawn yet
+    if (bin_sizes.empty() || size.isEmpty()) return false;
+    
+    QPainter painter(&frame);
+    painter.fillRect(QRectF(0, 0, w, h), Qt::white);
+    painter.setPen(Qt::black);
+    painter.setRenderHint(QPainter::Antialiasing, true);
+    QFont font = painter.font();
+    font.setPointSize(font.pointSizeF()*1.1);
+    QPainterPath path;
+    // twelve notes, TODO = temperament. Here 12ET
+    for (int i=0; i<12; ++i) {
+        path.moveTo(xy(0.,0.));
+        path.lineTo(xy(note_positions[i].real(), note_positions[i].imag()));
+        painter.drawText(xy(note_positions[i].real()*1.05-0.02, note_positions[i].imag()*1.05-0.01), note_names[i]);
+    }
+    painter.drawPath(path);
+    
+    int num_octaves = (max_midi_note - min_midi_note +11)/12;
+    
+    // The base spiral part of the outline is fixed for a given size
+    int num_bins = bin_sizes.size();
+    if (spiral_outline.size() != 3*num_bins+1) {
+        spiral_outline.resize(3*num_bins+1);
+        for (int b=0; b<=num_bins; ++b) {
+            spiral_outline[2*num_bins+b] = xy(spiral_positions[num_bins-b].real(),spiral_positions[num_bins-b].imag());
+        }
+        outline_radii.resize(2*num_bins);
+    }
+    // power normalised between 0 and 1 => 0.1 = spiral branch
+    const float amplitude_scale = 0.8f/num_octaves * hw_half;
+    const float gain = this->gain;
+    
+    for (int id=0; id<num_ID; ++id) {
+        QImage& image = fading_images[id];
+        bool new_image = image.size()!=frame.size();
+        if (new_image) {
+            image = QImage(frame.size(), QImage::Format_ARGB32_Premultiplied);
+            image.setDevicePixelRatio(ratio);
+            image.fill(Qt::transparent);
+        }
+        // a source without a new spectrum is only composited again
+        if (!new_image && !(dirty_sources & (1u<<id))) {
+            painter.drawImage(QPointF(0, 0), image);
+            continue;
+        }
+        
+        // Each bin is drawn as a flat segment at the power radius above its
+        // two bounds. First the radii, in a loop the compiler vectorizes...
+        const float* spectrum = spectrum_buffers[id].latest().data();
+        float* radii = outline_radii.data();
+        for (int b=0; b<num_bins; ++b) {
+            float amplitude = amplitude_scale * min(1.f, spectrum[b] * gain);
+            radii[2*b] = spiral_r_a[b].r * hw_half + amplitude;
+            radii[2*b+1] = spiral_r_a[b+1].r * hw_half + amplitude;
+        }
+        // ... then the points, from the precomputed cos/sin of the bounds
+        QPointF* outline = spiral_outline.data();
+        for (int b=0; b<num_bins; ++b) {
+            outline[2*b] = QPointF(w_half + radii[2*b] * spiral_cos[b], h_half - radii[2*b] * spiral_sin[b]);
+            outline[2*b+1] = QPointF(w_half + radii[2*b+1] * spiral_cos[b+1], h_half - radii[2*b+1] * spiral_sin[b+1]);
+        }
+        
+        // the older spirals fade to transparency, hence to the white background
+        if (!new_image) fade_image(image, fading_factor);
+        
+        // only the newest spiral is rasterized, in full color
+        QPainter image_painter(&image);
+        image_painter.setRenderHint(QPainter::Antialiasing, true);
+        QColor c = id==1 ? QColor(Qt::red) : QColor(Qt::blue);
+        image_painter.setBrush(c);
+        image_painter.setPen(c);
+        // the outline does not cross itself, the contour only reaches the
+        // next spiral branch at full power, so there is nothing to simplify
+        image_painter.drawPolygon(spiral_outline, Qt::WindingFill);
+        image_painter.end();
+        
+        painter.drawImage(QPointF(0, 0), image);
+    }
+    
+    // Overlay the base spiral in black
+    if (base_spiral.isEmpty()) {
+        base_spiral.moveTo(xy(spiral_positions.back().real(),spiral_positions.back().imag()));
+        for (int b=spiral_positions.size()-1; b>=0; --b) {
+            base_spiral.lineTo(xy(spiral_positions[b].real(),spiral_positions[b].imag()));
+        }
+        //base_spiral = base_spiral.simplified();
+    }
+
+    painter.setPen(Qt::black);
+    painter.setBrush(Qt::NoBrush);
+    painter.drawPath(base_spiral);
+    return true;
+}
+
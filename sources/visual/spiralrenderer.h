@@ -0,0 +1,182 @@
+/* 
+  Analyseur de MUsique et ENtraînement au CHAnt
+
+  This file is released under either of the two licenses below, your choice:
+  - LGPL v2.1 or later, https://www.gnu.org
+    The GNU Lesser General Public Licence, version 2.1 or,
+    at your option, any later version.
+  - CeCILL-C, http://www.cecill.info
+    The CeCILL-C license is more adapted to the French laws,
+    but can be converted to the GNU LGPL.
+  
+  You can use, modify and/or redistribute the software under the terms of any
+  of these licences, which should have been provided to you together with this
+  sofware. If that is not the case, you can find a copy of the licences on
+  the indicated web sites.
+  
+  By Nicolas . Brodu @ Inria . fr
+  
+  See http://nicolas.brodu.net/programmation/amuencha/ for more information
+*/
+
+
+#ifndef SPIRAL_RENDERER_H
+#define SPIRAL_RENDERER_H
+
+#include <QImage>
+#include <QPolygonF>
+#include <QPainterPath>
+#include <QString>
+#include <QSize>
+
+#include <vector>
+#include <complex>
+#include <atomic>
+#include <cstdint>
+
+// Geometry and drawing of the spiral, independent of any widget, so the
+// same frames can be rendered on screen (see SpiralDisplay) or offscreen
+// (see SpiralVideo).
+// The owner serializes the calls, except map_spectrum: each source may map
+// its spectra on its own thread, concurrently with the rendering, as long as
+// the geometry does not change meanwhile.
+class SpiralRenderer
+{
+public:
+    SpiralRenderer();
+    
+    static const int num_ID = 2;
+    
+    // Both change the analysis frequencies
+    void set_min_max_notes(int min_midi_note, int max_midi_note);
+    // Resolution of the analysis, independent of the drawing size
+    void set_bins_per_semitone(int bins);
+    // Logical size of the drawing, frames are rendered at size * ratio device pixels
+    void set_size(QSize size, qreal ratio);
+    QSize get_device_size() const {return size * ratio;}
+    qreal get_ratio() const {return ratio;}
+    void set_gain(float gain) {this->gain = gain;}
+    void set_visual_fading(int value);
+    // forgets the older spirals
+    void clear_fading();
+    
+    QString get_note_name_and_frequency(int midi_note) const;
+    
+    // central frequencies (log space) given to the analyzers
+    // The display resamples the spectrum on its own pixel bins
+    const std::vector<float>& get_frequencies() const {return frequencies;}
+    
+    // Resamples the spectrum of the source, computed at get_frequencies(), on the display bins
+    // Returns false when there is nothing to draw on yet, or the spectrum is stale
+    bool map_spectrum(int ID, const std::vector<float>& reassigned_frequencies, const std::vector<float>& power_spectrum);
+    
+    // Only the dirty sources get a new spiral, the others are left as is
+    // The frame must be at the device size, with the device pixel ratio set
+    // Returns false when there is nothing to render yet
+    bool render(QImage& frame, unsigned int dirty_sources);
+    
+protected:
+    int min_midi_note = 0, max_midi_note = 0;
+    int bins_per_semitone = 10;
+    std::atomic<float> gain {1};
+    QSize size;
+    qreal ratio = 1;
+    
+    // the analysis frequencies, from the notes and bins_per_semitone
+    void compute_frequencies();
+    // the display bins, from the notes and the size
+    void compute_display_bins();
+    // the cached drawing depends on the size and the notes
+    void clear_drawing();
+    
+    std::vector<float> frequencies;
+    // width of each analysis bin, in Hz, over which its power is spread
+    std::vector<float> analysis_bin_sizes;
+    
+    // The spectra on the drawing bins, handed over from the analyzer threads
+    // to the render thread by one triple buffer per source. The analyzer maps
+    // into the back buffer, then swaps it with the middle one. The renderer
+    // swaps its front buffer with the middle one when the latter holds a newer
+    // spectrum. Neither side ever waits for the other, nor copies a spectrum.
+    struct Spectrum_Buffer {
+        std::vector<float> spectra[3];
+        // index of the middle buffer, flagged when it was written since the last swap
+        static const int fresh = 4;
+        std::atomic<int> middle {1};
+        // each owned by one side
+        int back = 0, front = 2;
+        
+        void resize(int num_bins);
+        // writer side
+        std::vector<float>& back_spectrum() {return spectra[back];}
+        void publish() {back = middle.exchange(back | fresh, std::memory_order_acq_rel) & 3;}
+        // reader side, the latest published spectrum
+        const std::vector<float>& latest() {
+            if (middle.load(std::memory_order_relaxed) & fresh) front = middle.exchange(front, std::memory_order_acq_rel) & 3;
+            return spectra[front];
+        }
+    };
+    Spectrum_Buffer spectrum_buffers[num_ID];
+    
+    // bin low bounds, each bin consists of [f_b, f_b+1)
+    std::vector<float> display_bins;
+    // duplicate info for faster processing = delta_f in each bin
+    std::vector<float> bin_sizes;
+    std::vector<float> inv_bin_sizes;
+    
+    // Constant-time lookup of the display bin of a frequency
+    // The bits of a positive float, read as an integer, grow monotonically and
+    // almost linearly with its log2. Dropping the low mantissa bits gives a
+    // uniform log2 grid, with cells narrower than the display bins. Each cell
+    // stores the bin containing its lowest frequency, at most one step away
+    // from the bin of any frequency in the cell.
+    void compute_bin_grid();
+    // cells of count positive frequencies, 4 at a time
+    void grid_cells(const float* frequencies, int count, uint32_t* cells) const;
+    // the frequency must be in the display range
+    inline int display_bin(float f, uint32_t cell) const {
+        int b = bin_grid[cell];
+        return f>=display_bins[b+1] ? b+1 : b;
+    }
+    int bin_grid_shift = 0;
+    uint32_t bin_grid_base = 0;
+    std::vector<int> bin_grid;
+    // per source scratch, the sources may be mapped concurrently
+    struct Mapping_Scratch {
+        // bounds of the analysis bins spread around the reassigned frequencies
+        std::vector<float> low, high;
+        std::vector<uint32_t> low_cells, high_cells;
+    };
+    std::vector<Mapping_Scratch> mapping_scratch;
+    
+    // xy position of that frequency bin bound on the spiral
+    std::vector<std::complex<float>> spiral_positions;
+    // same info, but r.exp(angle)
+    // avoid all the sqrt, cos and sin at each redraw
+    struct Radius_Angle {float r, a;};
+    std::vector<Radius_Angle> spiral_r_a;
+    // and the cos/sin of these angles, for placing the power contour
+    std::vector<float> spiral_cos, spiral_sin;
+    // 12ET by default
+    std::vector<std::complex<float>> note_positions;
+    std::vector<QString> note_names;
+
+    // One persistent image per source. Each frame fades the previous ones
+    // by a constant factor, then only the newest spiral is drawn on top,
+    // so the cost does not depend on the fading depth
+    std::vector<QImage> fading_images;
+    QPainterPath base_spiral;
+    // Outline of the power spiral, in pixels: 2 points per bin along the
+    // power contour, then the base spiral back to the start, which only
+    // changes with the size
+    QPolygonF spiral_outline;
+    // radii of the power contour, in pixels
+    std::vector<float> outline_radii;
+    int visual_fading = 1;
+    // 0-256 scale applied to the fading images at each frame
+    std::atomic<int> fading_factor {0};
+    // remaining opacity of a spiral after visual_fading frames
+    static constexpr float fading_floor = 1.f/32;
+};
+
+#endif // SPIRAL_RENDERER_H
@@ -0,0 +1,258 @@
+/* 
+  Analyseur de MUsique et ENtraînement au CHAnt
+
+  This file is released under either of the two licenses below, your choice:
+  - LGPL v2.1 or later, https://www.gnu.org
+    The GNU Lesser General Public Licence, version 2.1 or,
+    at your option, any later version.
+  - CeCILL-C, http://www.cecill.info
+    The CeCILL-C license is more adapted to the French laws,
+    but can be converted to the GNU LGPL.
+  
+  You can use, modify and/or redistribute the software under the terms of any
+  of these licences, which should have been provided to you together with this
+  sofware. If that is not the case, you can find a copy of the licences on
+  the indicated web sites.
+  
+  By Nicolas . Brodu @ Inria . fr
+  
+  See http://nicolas.brodu.net/programmation/amuencha/ for more information
+*/
+
+
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <algorithm>
+
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+#include "spiralvideo.h"
+#include "spiralrenderer.h"
+#include "model/frequency_analyzer.h"
+#include "model/song_loader.h"
+#include "model/song_buffer.h"
+#include "model/song_analysis.h"
+#include "model/video_writer.h"
+
+using namespace std;
+
+SpiralVideo::SpiralVideo(const Options& options) : options(options)
+{
+}
+
+SpiralVideo::~SpiralVideo()
+{
+}
+
+// The output is never used as a format string: only a single %d or %0Nd
+// is accepted, for the frame number, and without any the frames are
+// numbered on 5 digits before the extension
+bool SpiralVideo::set_png_pattern(const std::string& output)
+{
+    size_t percent = output.find('%');
+    if (percent==string::npos) {
+        png_prefix = QString::fromStdString(output.substr(0, output.size()-4) + "_");
+        png_suffix = QString::fromStdString(output.substr(output.size()-4));
+        png_digits = 5;
+        return true;
+    }
+    size_t pos = percent + 1;
+    png_digits = 1;
+    if (pos<output.size() && output[pos]=='0') {
+        size_t digits_end = pos + 1;
+        while (digits_end<output.size() && isdigit((unsigned char)output[digits_end])) ++digits_end;
+        png_digits = digits_end>pos+1 ? atoi(output.substr(pos+1, digits_end-pos-1).c_str()) : 1;
+        pos = digits_end;
+    }
+    if (png_digits<1 || png_digits>20 || pos>=output.size() || output[pos]!='d'
+     || output.find('%', pos)!=string::npos) {
+        cerr << "Error: the PNG output accepts only a single %d or %0Nd, for the frame number" << endl;
+        return false;
+    }
+    png_prefix = QString::fromStdString(output.substr(0, percent));
+    png_suffix = QString::fromStdString(output.substr(pos+1));
+    return true;
+}
+
+int SpiralVideo::run()
+{
+    av_register_all();
+    
+    if (options.fps<=0 || options.width<=0 || options.height<=0 || options.sample_rate<=0) {
+        cerr << "Error: invalid video size, frame rate or sample rate" << endl;
+        return 1;
+    }
+    // PNG sequence when the output is an image, any other extension is a video container
+    string lower = options.output;
+    transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+    png_output = lower.size()>=4 && lower.compare(lower.size()-4, 4, ".png")==0;
+    if (png_output && !set_png_pattern(options.output)) return 1;
+    
+    if (!load_song()) return 1;
+    
+    // same analysis as the GUI, the frames are only a function of the song position
+    num_frames = (num_samples * options.fps + options.sample_rate - 1) / options.sample_rate;
+    // the older spirals are below 8-bit visibility after twice the fading depth
+    warmup = options.visual_fading>1 ? 2*options.visual_fading : 0;
+    // long enough chunks that rendering the warm-up frames again is a small overhead
+    chunk_size = max(64, 8*warmup);
+    int num_threads = options.num_threads>0 ? options.num_threads : max(1u, thread::hardware_concurrency());
+    num_threads = (int)min<int64_t>(num_threads, (num_frames + chunk_size - 1) / chunk_size);
+    num_threads = max(1, num_threads);
+    
+    Video_Writer writer;
+    if (!png_output) {
+        if (!writer.open(options.output, options.width, options.height, options.fps)) return 1;
+        // enough frames for the other threads to keep working while the oldest chunk completes
+        int64_t frame_bytes = (int64_t)options.width * options.height * 4;
+        max_pending_frames = max<int64_t>(chunk_size, min<int64_t>(2 * num_threads * chunk_size, max_pending_bytes / frame_bytes));
+    }
+    
+    auto start_time = chrono::steady_clock::now();
+    vector<thread> workers;
+    for (int t=0; t<num_threads; ++t) workers.emplace_back(&SpiralVideo::worker, this);
+    
+    if (png_output) {
+        while (num_rendered<num_frames && !failed) {
+            this_thread::sleep_for(chrono::milliseconds(500));
+            cout << "\rRendered " << num_rendered << " / " << num_frames << " frames" << flush;
+        }
+    } else {
+        while (next_frame_to_write<num_frames && !failed) {
+            QImage frame;
+            {
+                unique_lock<mutex> lock(pending_mutex);
+                pending_condition.wait(lock, [this]() {
+                    return failed || (!pending_frames.empty() && pending_frames.begin()->first==next_frame_to_write);
+                });
+                if (failed) break;
+                frame.swap(pending_frames.begin()->second);
+                pending_frames.erase(pending_frames.begin());
+            }
+            if (!writer.write(frame.constBits(), frame.bytesPerLine())) {
+                failed = true;
+                break;
+            }
+            {
+                lock_guard<mutex> lock(pending_mutex);
+                ++next_frame_to_write;
+            }
+            // room for the workers waiting on the window
+            pending_condition.notify_all();
+            if (next_frame_to_write % options.fps == 0) cout << "\rEncoded " << next_frame_to_write << " / " << num_frames << " frames" << flush;
+        }
+        pending_condition.notify_all();
+    }
+    for (auto& w: workers) w.join();
+    if (!png_output && !writer.close()) failed = true;
+    cout << endl;
+    if (failed) {
+        cerr << "Error: rendering " << options.output << " failed" << endl;
+        return 1;
+    }
+    
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start_time).count();
+    cout << "Rendered " << num_frames << " frames in " << seconds << " s (" << num_frames / max(1e-9, seconds)
+         << " fps) on " << num_threads << " threads" << endl;
+    return 0;
+}
+
+bool SpiralVideo::load_song()
+{
+    Song_Loader loader;
+    loader.set_cache_directory(options.cache_directory);
+    // the analysis needs direct access to the samples
+    Song_Loader::Status status = loader.start(options.song, options.sample_rate, Song_Buffer::FLOAT32);
+    if (status!=Song_Loader::OK) {
+        cerr << "Error: cannot decode the song " << options.song << endl;
+        return false;
+    }
+    while (!loader.is_finished()) this_thread::sleep_for(chrono::milliseconds(50));
+    Song_Buffer song;
+    Song_Analysis analysis;
+    status = loader.finish(song, analysis);
+    if ((status!=Song_Loader::OK && status!=Song_Loader::DECODE_ERROR) || song.empty() || !song.data()) {
+        cerr << "Error: cannot decode the song " << options.song << endl;
+        return false;
+    }
+    if (status==Song_Loader::DECODE_ERROR) cerr << "Error: the song could only be partially decoded" << endl;
+    
+    // the renderer sets the analysis frequencies, just as in the GUI
+    SpiralRenderer renderer;
+    renderer.set_bins_per_semitone(options.bins_per_semitone);
+    renderer.set_min_max_notes(options.min_midi_note, options.max_midi_note);
+    frequencies = renderer.get_frequencies();
+    
+    analyzer.reset(new Frequency_Analyzer());
+    analyzer->setup(options.sample_rate, frequencies, Frequency_Analyzer::PowerHandler(), options.periods);
+    window_size = analyzer->get_max_window_size();
+    num_samples = song.size();
+    signal.assign(window_size + num_samples, 0.f);
+    memcpy(signal.data() + window_size, song.data(), num_samples * sizeof(float));
+    return true;
+}
+
+void SpiralVideo::worker()
+{
+    // each worker draws with its own renderer, on its own fading images
+    SpiralRenderer renderer;
+    renderer.set_bins_per_semitone(options.bins_per_semitone);
+    renderer.set_min_max_notes(options.min_midi_note, options.max_midi_note);
+    renderer.set_size(QSize(options.width, options.height), 1);
+    renderer.set_gain(options.gain);
+    renderer.set_visual_fading(options.visual_fading);
+    
+    vector<float> reassigned, power;
+    QImage frame;
+    
+    while (!failed) {
+        int64_t chunk_start = next_chunk.fetch_add(chunk_size);
+        if (chunk_start>=num_frames) break;
+        int64_t chunk_end = min(num_frames, chunk_start + chunk_size);
+        
+        // rebuild the fading trail left by the frames before the chunk
+        renderer.clear_fading();
+        for (int64_t k = max<int64_t>(0, chunk_start - warmup); k<chunk_end && !failed; ++k) {
+            bool kept = k>=chunk_start;
+            if (kept && !png_output) {
+                // do not get too far ahead of the encoder, but never block
+                // the frame it is waiting for
+                unique_lock<mutex> lock(pending_mutex);
+                pending_condition.wait(lock, [this, k]() {return failed || k<next_frame_to_write+max_pending_frames;});
+                if (failed) break;
+            }
+            // the previous frame may have been handed over to the encoder
+            if (frame.isNull()) frame = QImage(options.width, options.height, QImage::Format_ARGB32_Premultiplied);
+            
+            int64_t position = min(num_samples, k * options.sample_rate / options.fps);
+            analyzer->compute_spectrum(signal.data() + window_size + position, reassigned, power);
+            renderer.map_spectrum(0, reassigned, power);
+            // the song is the only source
+            renderer.render(frame, 1);
+            if (!kept) continue;
+            
+            if (png_output) {
+                QString filename = png_prefix + QString("%1").arg((qlonglong)k, png_digits, 10, QChar('0')) + png_suffix;
+                if (!frame.save(filename, "PNG")) {
+                    cerr << "Error: cannot write " << filename.toStdString() << endl;
+                    failed = true;
+                }
+                ++num_rendered;
+                continue;
+            }
+            {
+                lock_guard<mutex> lock(pending_mutex);
+                pending_frames[k].swap(frame);
+            }
+            pending_condition.notify_all();
+        }
+    }
+    // wake up the encoder, in case it waits for a frame this worker will never render
+    if (failed) pending_condition.notify_all();
+}
@@ -0,0 +1,111 @@
+/* 
+  Analyseur de MUsique et ENtraînement au CHAnt
+
+  This file is released under either of the two licenses below, your choice:
+  - LGPL v2.1 or later, https://www.gnu.org
+    The GNU Lesser General Public Licence, version 2.1 or,
+    at your option, any later version.
+  - CeCILL-C, http://www.cecill.info
+    The CeCILL-C license is more adapted to the French laws,
+    but can be converted to the GNU LGPL.
+  
+  You can use, modify and/or redistribute the software under the terms of any
+  of these licences, which should have been provided to you together with this
+  sofware. If that is not the case, you can find a copy of the licences on
+  the indicated web sites.
+  
+  By Nicolas . Brodu @ Inria . fr
+  
+  See http://nicolas.brodu.net/programmation/amuencha/ for more information
+*/
+
+
+#ifndef SPIRAL_VIDEO_H
+#define SPIRAL_VIDEO_H
+
+#include <QImage>
+#include <QString>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <cstdint>
+
+class Frequency_Analyzer;
+
+// Renders the spiral animation of a whole song offline, without any window,
+// into a video file or a sequence of PNG images.
+// The frames are independent but for the fading of the older spirals, so
+// the song is cut into chunks of consecutive frames, rendered in parallel
+// by as many SpiralRenderer. Each chunk starts by rendering the few frames
+// before it, which rebuilds the fading trail, then only its own frames
+// are kept. The video frames are encoded in order as they complete.
+class SpiralVideo
+{
+public:
+    struct Options {
+        std::string song;
+        // .png, possibly with a printf pattern for the frame number, or any video container
+        std::string output;
+        // for the decoded song, empty for no cache
+        std::string cache_directory;
+        int width = 1280, height = 720;
+        int fps = 30;
+        int sample_rate = 48000;
+        // 0 for the number of cores
+        int num_threads = 0;
+        // same defaults as the GUI
+        int min_midi_note = 36, max_midi_note = 84;
+        int bins_per_semitone = 10;
+        float periods = 30;
+        float gain = 256;
+        int visual_fading = 2;
+    };
+    
+    explicit SpiralVideo(const Options& options);
+    ~SpiralVideo();
+    
+    // Blocks until the whole song is rendered, returns the process exit code
+    int run();
+    
+protected:
+    bool load_song();
+    void worker();
+    // frames kept in memory, waiting for their turn to be encoded
+    static const int64_t max_pending_bytes = 1<<30;
+    
+    Options options;
+    bool png_output = false;
+    // the frame number, padded with zeros to png_digits, goes between the prefix and the suffix
+    QString png_prefix, png_suffix;
+    int png_digits = 5;
+    bool set_png_pattern(const std::string& output);
+    
+    // the song, preceded by a window of silence so the first frames have a full analysis window
+    std::vector<float> signal;
+    int window_size = 0;
+    int64_t num_samples = 0;
+    std::vector<float> frequencies;
+    // shared by the workers, the spectrum computation is thread-safe
+    std::unique_ptr<Frequency_Analyzer> analyzer;
+    
+    int64_t num_frames = 0;
+    int64_t chunk_size = 0;
+    int warmup = 0;
+    std::atomic<int64_t> next_chunk {0};
+    std::atomic<bool> failed {false};
+    std::atomic<int64_t> num_rendered {0};
+    
+    // video frames completed out of order, for the encoder
+    std::mutex pending_mutex;
+    std::condition_variable pending_condition;
+    std::map<int64_t, QImage> pending_frames;
+    int64_t next_frame_to_write = 0;
+    int64_t max_pending_frames = 0;
+};
+
+#endif // SPIRAL_VIDEO_H
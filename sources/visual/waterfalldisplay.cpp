@@ -0,0 +1,174 @@
+/* 
+  Analyseur de MUsique et ENtraînement au CHAnt
+
+  This file is released under either of the two licenses below, your choice:
+  - LGPL v2.1 or later, https://www.gnu.org
+    The GNU Lesser General Public Licence, version 2.1 or,
+    at your option, any later version.
+  - CeCILL-C, http://www.cecill.info
+    The CeCILL-C license is more adapted to the French laws,
+    but can be converted to the GNU LGPL.
+  
+  You can use, modify and/or redistribute the software under the terms of any
+  of these licences, which should have been provided to you together with this
+  sofware. If that is not the case, you can find a copy of the licences on
+  the indicated web sites.
+  
+  By Nicolas . Brodu @ Inria . fr
+  
+  See http://nicolas.brodu.net/programmation/amuencha/ for more information
+*/
+
+
+#include <QPainter>
+#include "waterfalldisplay.h"
+
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+
+WaterfallDisplay::WaterfallDisplay(QWidget *parent) : QWidget(parent)
+{
+    QPalette pal(palette());
+    pal.setColor(QPalette::Background, Qt::white);
+    setAutoFillBackground(true);
+    setPalette(pal);
+    
+    for (int id=0; id<num_ID; ++id) {
+        lanes[id].palette.resize(256);
+        for (int l=0; l<256; ++l) {
+            int whitefactor = 255 - l;
+            if (id==1) lanes[id].palette[l] = qRgb(255,whitefactor,whitefactor);
+            else lanes[id].palette[l] = qRgb(whitefactor,whitefactor,255);
+        }
+    }
+}
+
+void WaterfallDisplay::set_frequencies(const std::vector<float>& frequencies)
+{
+    for (int id=0; id<num_ID; ++id) lanes[id].mutex.lock();
+    num_rows = frequencies.size();
+    if (num_rows>1) {
+        log2_fmin = log2(frequencies.front());
+        rows_per_octave = (num_rows - 1) / (log2(frequencies.back()) - log2_fmin);
+    }
+    for (int id=0; id<num_ID; ++id) {
+        reset_lane(lanes[id]);
+        lanes[id].mutex.unlock();
+    }
+    update();
+}
+
+void WaterfallDisplay::set_gain(float gain)
+{
+    this->gain = gain;
+}
+
+void WaterfallDisplay::reset_lane(Lane& lane)
+{
+    lane.rows.assign(num_rows, 0.f);
+    lane.column = 0;
+    if (!shown || num_rows<1 || num_columns<1) {
+        lane.image = QImage();
+        return;
+    }
+    lane.image = QImage(num_columns, num_rows, QImage::Format_RGB32);
+    lane.image.fill(Qt::white);
+}
+
+void WaterfallDisplay::reset_lanes()
+{
+    for (int id=0; id<num_ID; ++id) {
+        lock_guard<mutex> lock(lanes[id].mutex);
+        reset_lane(lanes[id]);
+    }
+}
+
+void WaterfallDisplay::power_handler(int ID, const vector<float>& reassigned_frequencies, const vector<float>& power_spectrum)
+{
+    if (!shown) return;
+    Lane& lane = lanes[ID];
+    {
+        // The analyzer never waits for the GUI: while a lane is painted or
+        // resized, this spectrum is dropped, as on the spiral
+        unique_lock<mutex> lock(lane.mutex, try_to_lock);
+        if (!lock.owns_lock() || lane.image.isNull()) return;
+        
+        // The power goes to the row of its reassigned frequency, which
+        // sharpens the lines just like on the spiral
+        fill(lane.rows.begin(), lane.rows.end(), 0.f);
+        int nidx = power_spectrum.size();
+        for (int idx=0; idx<nidx; ++idx) {
+            float rf = reassigned_frequencies[idx];
+            if (!(rf>0)) continue;
+            int row = (int)lrintf((log2f(rf) - log2_fmin) * rows_per_octave);
+            if (row<0 || row>=num_rows) continue;
+            lane.rows[row] += power_spectrum[idx];
+        }
+        
+        // Only the oldest column is overwritten, high frequencies on top
+        const float scale = 255 * gain;
+        QRgb* pixel = reinterpret_cast<QRgb*>(lane.image.bits()) + lane.column;
+        const int stride = lane.image.bytesPerLine() / sizeof(QRgb);
+        for (int row=num_rows-1; row>=0; --row, pixel+=stride) {
+            int level = (int)min(255.f, lane.rows[row] * scale);
+            *pixel = lane.palette[level];
+        }
+        if (++lane.column==lane.image.width()) lane.column = 0;
+    }
+    // the widget itself can only be painted from the GUI thread
+    QMetaObject::invokeMethod(this, "update", Qt::QueuedConnection);
+}
+
+void WaterfallDisplay::paintEvent(QPaintEvent *event)
+{
+    QPainter painter(this);
+    const qreal ratio = devicePixelRatioF();
+    const qreal lane_height = height() / (qreal)num_ID;
+    for (int id=0; id<num_ID; ++id) {
+        Lane& lane = lanes[id];
+        lock_guard<mutex> lock(lane.mutex);
+        if (lane.image.isNull()) continue;
+        // The oldest columns, from the write position to the end, go on the
+        // left, then the newest ones from the start of the image
+        const int w = lane.image.width();
+        const int h = lane.image.height();
+        const int num_old = w - lane.column;
+        const qreal split = num_old / ratio;
+        const qreal top = id * lane_height;
+        painter.drawImage(QRectF(0, top, split, lane_height), lane.image, QRectF(lane.column, 0, num_old, h));
+        if (lane.column>0) {
+            painter.drawImage(QRectF(split, top, lane.column / ratio, lane_height), lane.image, QRectF(0, 0, lane.column, h));
+        }
+    }
+    // separate the song from the voice
+    painter.setPen(Qt::black);
+    painter.drawLine(QPointF(0, lane_height), QPointF(width(), lane_height));
+}
+
+void WaterfallDisplay::resizeEvent(QResizeEvent *event)
+{
+    // one column per device pixel, the history is lost only when the width changes
+    int columns = (int)(width() * devicePixelRatioF());
+    if (columns==num_columns) return;
+    for (int id=0; id<num_ID; ++id) lanes[id].mutex.lock();
+    num_columns = columns;
+    for (int id=0; id<num_ID; ++id) {
+        reset_lane(lanes[id]);
+        lanes[id].mutex.unlock();
+    }
+}
+
+void WaterfallDisplay::showEvent(QShowEvent *event)
+{
+    shown = true;
+    reset_lanes();
+}
+
+void WaterfallDisplay::hideEvent(QHideEvent *event)
+{
+    // the hidden view holds no image and ignores the spectra
+    shown = false;
+    reset_lanes();
+}
@@ -0,0 +1,89 @@
+/* 
+  Analyseur de MUsique et ENtraînement au CHAnt
+
+  This file is released under either of the two licenses below, your choice:
+  - LGPL v2.1 or later, https://www.gnu.org
+    The GNU Lesser General Public Licence, version 2.1 or,
+    at your option, any later version.
+  - CeCILL-C, http://www.cecill.info
+    The CeCILL-C license is more adapted to the French laws,
+    but can be converted to the GNU LGPL.
+  
+  You can use, modify and/or redistribute the software under the terms of any
+  of these licences, which should have been provided to you together with this
+  sofware. If that is not the case, you can find a copy of the licences on
+  the indicated web sites.
+  
+  By Nicolas . Brodu @ Inria . fr
+  
+  See http://nicolas.brodu.net/programmation/amuencha/ for more information
+*/
+
+
+#ifndef WATERFALL_DISPLAY_H
+#define WATERFALL_DISPLAY_H
+
+#include <QWidget>
+#include <QPaintEvent>
+#include <QImage>
+
+#include <vector>
+#include <mutex>
+#include <atomic>
+
+// Scrolling spectrogram of the recent spectra, the song above and the voice
+// below, on the same time axis.
+// Each source has a circular image, one row per analysis frequency and one
+// column per widget pixel. Each new spectrum overwrites the oldest column,
+// and the view is composited in two blits at the wrap point, so the history
+// is never moved nor rendered again.
+class WaterfallDisplay : public QWidget
+{
+    Q_OBJECT
+public:
+    explicit WaterfallDisplay(QWidget *parent = 0);
+    
+    // The analysis frequencies, uniform in log space, see SpiralDisplay
+    void set_frequencies(const std::vector<float>& frequencies);
+    void set_gain(float gain);
+    
+    // Same callback as SpiralDisplay::power_handler, called from the analyzer threads
+    void power_handler(int ID, const std::vector<float>& reassigned_frequencies, const std::vector<float>& power_spectrum);
+    
+    static const int num_ID = 2;
+    
+protected:
+    struct Lane {
+        // held while writing a column, and while blitting
+        std::mutex mutex;
+        QImage image;
+        // next column to write, that is the oldest one
+        int column = 0;
+        // power per row of the current spectrum
+        std::vector<float> rows;
+        // white to the source color, same as the spiral
+        std::vector<QRgb> palette;
+    };
+    Lane lanes[num_ID];
+    
+    // row of a frequency = (log2(f) - log2_fmin) * rows_per_octave
+    float log2_fmin = 0;
+    float rows_per_octave = 1;
+    int num_rows = 0;
+    std::atomic<float> gain {1};
+    
+    // device pixel size at the last resize, so the columns map to pixels
+    int num_columns = 0;
+    // the images only exist while the widget is shown
+    std::atomic<bool> shown {false};
+    void reset_lane(Lane& lane);
+    void reset_lanes();
+    
+    // QWidget interface
+    void paintEvent(QPaintEvent *event);
+    void resizeEvent(QResizeEvent *event);
+    void showEvent(QShowEvent *event);
+    void hideEvent(QHideEvent *event);
+};
+
+#endif // WATERFALL_DISPLAY_H